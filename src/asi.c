@@ -1,6 +1,8 @@
 #include <stdbool.h>
 #include <sndfile.h>
 #include <fftw3.h>
+#include "pool.h"
+#include "sample_io.h"
 
 #define FATAL "[FATAL] "
 #define ERROR "[ERROR] "
@@ -43,7 +45,7 @@ bool read_audio(const char* fname, Audiodata* ad) {
 
     ad->i = sfinfo;
     buf_resize_soft_sample(&ad->b, sfinfo.frames * sfinfo.channels);
-    sf_count_t written = sf_readf_double(s, ad->b.data, sfinfo.frames);
+    sf_count_t written = sf_readf_sample(s, ad->b.data, sfinfo.frames, sfinfo.channels);
 
     if (written < sfinfo.frames)
         LOG(WARN "read_audio: Could not read entire file.");
@@ -4,14 +4,48 @@
 #include <stdlib.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <float.h>
 #include <fftw3.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <sndfile.h>
+#include "fft.h"
+#include "pool.h"
+#include "trace.h"
+#include "sample_io.h"
+#include "simd.h"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+double now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
 
-static float* generate_hann_window(size_t sz) {
-    float* w = calloc(sz, sizeof(float));
+static sample* generate_hann_window(size_t sz) {
+    sample* w = calloc(sz, sizeof(sample));
     assert(w);
 
     for (size_t n = 0; n < sz; n++) {
@@ -20,8 +54,8 @@ static float* generate_hann_window(size_t sz) {
     return w;
 }
 
-static float* generate_none_window(size_t sz) {
-    float* w = calloc(sz, sizeof(float));
+static sample* generate_none_window(size_t sz) {
+    sample* w = calloc(sz, sizeof(sample));
     assert(w);
 
     for (size_t n = 0; n < sz; n++) {
@@ -30,55 +64,181 @@ static float* generate_none_window(size_t sz) {
     return w;
 }
 
-enum WindowFunction {
-    WF_HANN,
-    WF_NONE,
-};
+// Window kernels: dst[i] = src[i * stride] * window[i] for i < n. This is the copy out of the source audio
+// and the windowing in one pass. Every variant does exactly one multiply per sample and nothing else, so
+// they all produce the same bits as the scalar one.
+static void window_kernel_scalar(sample* dst, const sample* src, size_t stride, const sample* window, size_t n) {
+    if (stride == 1) {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = src[i] * window[i];
+    } else {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = src[i * stride] * window[i];
+    }
+}
 
-typedef struct {
-    float* window_function;
+#ifdef HAVE_X86_DISPATCH
+__attribute__((target("avx2")))
+static void window_kernel_avx2(float* dst, const float* src, size_t stride, const float* window, size_t n) {
+    size_t i = 0;
+    if (stride == 1) {
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), _mm256_loadu_ps(window + i)));
+    } else if (stride <= INT32_MAX / 8) {
+        const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+        for (; i + 8 <= n; i += 8) {
+            const __m256 x = _mm256_i32gather_ps(src + i * stride, offsets, sizeof(float));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(x, _mm256_loadu_ps(window + i)));
+        }
+    }
+    window_kernel_scalar(dst + i, src + i * stride, stride, window + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void window_kernel_avx512(float* dst, const float* src, size_t stride, const float* window, size_t n) {
+    // Gathers aren't any faster at 16 wide, so strided input takes the AVX2 path.
+    if (stride != 1) {
+        window_kernel_avx2(dst, src, stride, window, n);
+        return;
+    }
 
-    size_t window_size;
-    size_t hop_size;
-    float* time_buf;
-    fftwf_complex* freq_buf;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_loadu_ps(src + i), _mm512_loadu_ps(window + i)));
+    window_kernel_scalar(dst + i, src + i, 1, window + i, n - i);
+}
+#elif defined(HAVE_NEON_KERNELS)
+static void window_kernel_neon(float* dst, const float* src, size_t stride, const float* window, size_t n) {
+    size_t i = 0;
+    if (stride == 1) {
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), vld1q_f32(window + i)));
+    }
+    window_kernel_scalar(dst + i, src + i * stride, stride, window + i, n - i);
+}
+#endif
 
-    fftwf_plan forward;
-    fftwf_plan reverse;
-} FFTKernel;
+// The best kernel this CPU can run. Setting FOURIEDIT_NO_SIMD forces the scalar one, for comparisons.
+static WindowKernel window_kernel_select(void) {
+    if (getenv("FOURIEDIT_NO_SIMD"))
+        return window_kernel_scalar;
+
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return window_kernel_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return window_kernel_avx2;
+#elif defined(HAVE_NEON_KERNELS)
+    return window_kernel_neon;
+#endif
+    return window_kernel_scalar;
+}
 
-typedef struct {
-    size_t sample_rate;
+size_t cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
 
-    size_t frames;
-    float* data;
+// Runs tasks from the current batch until there are none left. Called with the lock held.
+static void threadpool_drain(ThreadPool* pool, size_t worker) {
+    while (pool->next_task < pool->task_count) {
+        size_t task = pool->next_task++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->ctx, task, worker);
+        pthread_mutex_lock(&pool->lock);
+    }
+}
 
-    int channels;
-} Audiodata;
+static void* threadpool_main(void* arg) {
+    PoolWorker* self = arg;
+    ThreadPool* pool = self->pool;
+    unsigned long seen = 0;
 
-// Remember, this stores them as a contiguous array of Audiodata, not an array of pointers to Audiodata.
-typedef struct {
-    int count;
-    Audiodata* data;
-} AudiodataMany;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
 
-typedef struct {
-    // Justification: in a reversal operation, the default behavior (non-specified) should be to preserve sample rate.
-    size_t sample_rate;
+        threadpool_drain(pool, self->index);
 
-    // Justification: the original length of audio is rounded.
-    size_t original_length;
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
 
-    size_t window_count;
+ThreadPool* threadpool_create(size_t thread_count) {
+    if (thread_count == 0)
+        thread_count = cpu_count();
+
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    assert(pool);
+    pool->thread_count = thread_count;
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    assert(pool->threads);
+    pool->workers = calloc(thread_count, sizeof(PoolWorker));
+    assert(pool->workers);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (size_t i = 1; i < thread_count; i++) {
+        pool->workers[i] = (PoolWorker){ .pool = pool, .index = i };
+        int err = pthread_create(&pool->threads[i], NULL, threadpool_main, &pool->workers[i]);
+        assert(err == 0);
+        (void)err;
+    }
+    return pool;
+}
 
-    // Guaranteed to have a size of sd->window_count * (fk->window_size / 2 + 1).
-    // Yes, it is necessarily associated with the kernel.
-    fftwf_complex* data;
+void threadpool_run(ThreadPool* pool, PoolTask task, void* ctx, size_t task_count) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->busy = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+
+    threadpool_drain(pool, 0);
+
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
 
-    // There is no option for interlacing windows. Just seems like unnecessary copying.
-} Spectrodata;
+void threadpool_destroy(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 1; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
 
 AudiodataMany* audiodata_split_channels(const Audiodata* ad) {
+    TRACE_SCOPE("split_channels");
     AudiodataMany* am = calloc(1, sizeof(AudiodataMany));
     assert(am);
 
@@ -90,11 +250,10 @@ AudiodataMany* audiodata_split_channels(const Audiodata* ad) {
     for (int i = 0; i < channel_count; i++) {
         Audiodata new_ad = {
             .channels = 1,
-            .data = calloc(ad->frames, sizeof(float)),
+            .data = pool_alloc(ad->frames * sizeof(sample)),
             .frames = ad->frames,
             .sample_rate = ad->sample_rate
         };
-        assert(new_ad.data);
         am->data[i] = new_ad;
     }
 
@@ -107,15 +266,34 @@ AudiodataMany* audiodata_split_channels(const Audiodata* ad) {
     return am;
 }
 
+Audiodata* audiodata_join_channels(const AudiodataMany* am) {
+    TRACE_SCOPE("join_channels");
+    Audiodata *ad = calloc(1, sizeof(Audiodata));
+    assert(ad);
+
+    ad->channels = am->count;
+    ad->frames = am->data[0].frames;
+    ad->sample_rate = am->data[0].sample_rate;
+    ad->data = pool_alloc(ad->frames * ad->channels * sizeof(sample));
+
+    for (int channel = 0; channel < am->count; channel++) {
+        assert(am->data[channel].frames == ad->frames);
+        for (size_t frame = 0; frame < ad->frames; frame++)
+            ad->data[am->count * frame + channel] = am->data[channel].data[frame];
+    }
+
+    return ad;
+}
+
 void audiodata_many_destroy(AudiodataMany *am) {
     for (int i = 0; i < am->count; i++)
-        free(am->data[i].data);
+        pool_free(am->data[i].data);
     free(am->data);
     free(am);
 }
 
-// Check return value.
 Audiodata* audiodata_read_file(const char* fname) {
+    TRACE_SCOPE("read_audio");
     SF_INFO sfinfo = {};
 
     SNDFILE *sndfile = sf_open(fname, SFM_READ, &sfinfo);
@@ -131,16 +309,22 @@ Audiodata* audiodata_read_file(const char* fname) {
     ret->frames = sfinfo.frames;
     ret->channels = sfinfo.channels;
 
-    ret->data = calloc(ret->frames * ret->channels, sizeof(float));
-    assert(ret->data);
-    
-    (void) sf_readf_float(sndfile, ret->data, sfinfo.frames);
+    ret->data = pool_calloc(ret->frames, ret->channels * sizeof(sample));
+    if (!ret->data) {
+        fprintf(stderr, "Audio file '%s' is too big: %zu frames of %d channels.\n", fname, ret->frames, ret->channels);
+        sf_close(sndfile);
+        free(ret);
+        return NULL;
+    }
+
+    (void) sf_readf_sample(sndfile, ret->data, sfinfo.frames, sfinfo.channels);
 
     sf_close(sndfile);
     return ret;
 }
 
 void audiodata_write_file(const char* fname, const Audiodata* ad) {
+    TRACE_SCOPE("write_audio");
     SF_INFO sfinfo = {
         .channels = ad->channels,
         .format = SF_FORMAT_WAV | SF_FORMAT_PCM_16,
@@ -154,22 +338,151 @@ void audiodata_write_file(const char* fname, const Audiodata* ad) {
         return;
     }
 
-    sf_count_t written = sf_writef_float(sndfile, ad->data, ad->frames);
+    sf_count_t written = sf_writef_sample(sndfile, ad->data, ad->frames, ad->channels);
     if ((size_t)written < ad->frames) {
-        fprintf(stderr, "Couldn't write all frames (%lld/%lld) to audio file '%s': %s\n", written, ad->frames, fname, sf_strerror(sndfile));
+        fprintf(stderr, "Couldn't write all frames (%lld/%zu) to audio file '%s': %s\n", (long long)written, ad->frames, fname, sf_strerror(sndfile));
     }
-    fprintf(stderr, "Yeah. %s\n", sf_strerror(sndfile));
 
     sf_close(sndfile);
 }
 
 void audiodata_destroy(Audiodata* ad) {
-    free(ad->data);
+    pool_free(ad->data);
     free(ad);
 }
 
-// Must succeed.
+// FFTW wisdom cache.
+// Planning with FFTW_PATIENT takes seconds for the bigger window sizes, so the measured plans are kept in
+// a per-user file, one per precision and CPU model. FFTW keys the plans inside it by transform size.
+// The file is read before the first kernel is made, and written back at exit if anything new was measured.
+static struct {
+    bool loaded;
+    bool dirty;
+    bool may_block;
+    char path[1024];
+
+    // FFTW's planner isn't thread-safe, so everything that loads wisdom, makes a plan or destroys one holds this.
+    pthread_mutex_t lock;
+} wisdom = { .may_block = true, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void wisdom_cpu_name(char* out, size_t size) {
+    char brand[49] = "generic";
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned regs[12];
+    if (__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) && regs[0] >= 0x80000004) {
+        for (unsigned i = 0; i < 3; i++)
+            __get_cpuid(0x80000002 + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+        memcpy(brand, regs, 48);
+        brand[48] = '\0';
+    }
+#elif defined(__aarch64__)
+    strcpy(brand, "aarch64");
+#endif
+
+    size_t n = 0;
+    for (const char* c = brand; *c && n + 1 < size; c++) {
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9'))
+            out[n++] = *c;
+        else if (n > 0 && out[n - 1] != '-')
+            out[n++] = '-';
+    }
+    while (n > 0 && out[n - 1] == '-')
+        n--;
+    out[n] = '\0';
+}
+
+// Creates every missing directory leading up to the file at `path`.
+static void make_parent_dirs(const char* path) {
+    char buf[sizeof(wisdom.path)];
+    snprintf(buf, sizeof(buf), "%s", path);
+
+    for (char* c = buf + 1; *c; c++) {
+        if (*c != '/' && *c != '\\')
+            continue;
+        char sep = *c;
+        *c = '\0';
+#ifdef _WIN32
+        _mkdir(buf);
+#else
+        mkdir(buf, 0755);
+#endif
+        *c = sep;
+    }
+}
+
+// $FOURIEDIT_WISDOM if set, otherwise somewhere in the user's cache directory.
+static void wisdom_default_path(char* out, size_t size) {
+    const char* env = getenv("FOURIEDIT_WISDOM");
+    if (env && *env) {
+        snprintf(out, size, "%s", env);
+        return;
+    }
+
+    char cpu[64];
+    wisdom_cpu_name(cpu, sizeof(cpu));
+
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    snprintf(out, size, "%s\\fouriedit\\" FFTW_PREFIX "-%s.wisdom", base ? base : ".", cpu);
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg)
+        snprintf(out, size, "%s/fouriedit/" FFTW_PREFIX "-%s.wisdom", xdg, cpu);
+    else
+        snprintf(out, size, "%s/.cache/fouriedit/" FFTW_PREFIX "-%s.wisdom", home ? home : ".", cpu);
+#endif
+}
+
+void wisdom_save(void) {
+    if (!wisdom.loaded || !wisdom.dirty)
+        return;
+
+    make_parent_dirs(wisdom.path);
+    if (!FFTW(export_wisdom_to_filename)(wisdom.path))
+        fprintf(stderr, "Couldn't write FFTW wisdom to '%s'.\n", wisdom.path);
+    else
+        wisdom.dirty = false;
+}
+
+const char* wisdom_write(void) {
+    wisdom.dirty = true;
+    wisdom_save();
+    return wisdom.dirty ? NULL : wisdom.path;
+}
+
+static void wisdom_load(void) {
+    if (wisdom.loaded)
+        return;
+    wisdom.loaded = true;
+
+    if (!wisdom.path[0])
+        wisdom_default_path(wisdom.path, sizeof(wisdom.path));
+
+    // A missing file is just a cold cache.
+    (void)FFTW(import_wisdom_from_filename)(wisdom.path);
+    atexit(wisdom_save);
+}
+
+void wisdom_configure(const char* path, bool may_block) {
+    assert(!wisdom.loaded);
+    if (path)
+        snprintf(wisdom.path, sizeof(wisdom.path), "%s", path);
+    wisdom.may_block = may_block;
+}
+
+// Flags to plan with after an FFTW_WISDOM_ONLY attempt came back empty.
+static unsigned wisdom_miss_flags(void) {
+    if (!wisdom.may_block)
+        return FFTW_ESTIMATE;
+
+    wisdom.dirty = true;
+    return FFTW_PATIENT;
+}
+
 FFTKernel* fftkernel_create(enum WindowFunction window_function, size_t window_size, size_t hop_size) {
+    TRACE_SCOPE("plan");
     FFTKernel *ret = calloc(1, sizeof(FFTKernel));
     assert(ret);
 
@@ -181,168 +494,2329 @@ FFTKernel* fftkernel_create(enum WindowFunction window_function, size_t window_s
         case WF_HANN:
             ret->window_function = generate_hann_window(window_size);
         break;
+
+        default:
+            fprintf(stderr, "fftkernel_create: Unknown window function %d.\n", (int)window_function);
+            free(ret);
+            return NULL;
     }
 
+    ret->scaled_window = calloc(window_size, sizeof(sample));
+    assert(ret->scaled_window);
+    for (size_t i = 0; i < window_size; i++)
+        ret->scaled_window[i] = ret->window_function[i] / window_size;
+    ret->window_kernel = window_kernel_select();
+
+    ret->window_type = window_function;
     ret->window_size = window_size;
     ret->hop_size = hop_size;
-    ret->time_buf = fftwf_alloc_real(window_size);
+    ret->time_buf = FFTW(alloc_real)(window_size);
     assert(ret->time_buf);
-    ret->freq_buf = fftwf_alloc_complex(window_size / 2 + 1);
+    ret->freq_buf = FFTW(alloc_complex)(window_size / 2 + 1);
     assert(ret->freq_buf);
 
-    ret->forward = fftwf_plan_dft_r2c_1d(window_size, ret->time_buf, ret->freq_buf, FFTW_PATIENT);
+    pthread_mutex_lock(&wisdom.lock);
+    wisdom_load();
+
+    ret->forward = FFTW(plan_dft_r2c_1d)(window_size, ret->time_buf, ret->freq_buf, FFTW_PATIENT | FFTW_WISDOM_ONLY);
+    if (!ret->forward)
+        ret->forward = FFTW(plan_dft_r2c_1d)(window_size, ret->time_buf, ret->freq_buf, wisdom_miss_flags());
     assert(ret->forward);
-    ret->reverse = fftwf_plan_dft_c2r_1d(window_size, ret->freq_buf, ret->time_buf, FFTW_PATIENT);
+    ret->reverse = FFTW(plan_dft_c2r_1d)(window_size, ret->freq_buf, ret->time_buf, FFTW_PATIENT | FFTW_WISDOM_ONLY);
+    if (!ret->reverse)
+        ret->reverse = FFTW(plan_dft_c2r_1d)(window_size, ret->freq_buf, ret->time_buf, wisdom_miss_flags());
     assert(ret->reverse);
+    pthread_mutex_unlock(&wisdom.lock);
     
     return ret;
 }
 
 void fftkernel_destroy(FFTKernel* fk) {
-    fftwf_destroy_plan(fk->forward);
-    fftwf_destroy_plan(fk->reverse);
-    fftwf_free(fk->time_buf);
-    fftwf_free(fk->freq_buf);
+    pthread_mutex_lock(&wisdom.lock);
+    FFTW(destroy_plan)(fk->forward);
+    FFTW(destroy_plan)(fk->reverse);
+    if (fk->forward_batch)
+        FFTW(destroy_plan)(fk->forward_batch);
+    if (fk->forward_split)
+        FFTW(destroy_plan)(fk->forward_split);
+    pthread_mutex_unlock(&wisdom.lock);
+
+    FFTW(free)(fk->time_buf);
+    FFTW(free)(fk->freq_buf);
+    for (size_t i = 0; i < fk->worker_count; i++) {
+        FFTW(free)(fk->workers[i].time_buf);
+        FFTW(free)(fk->workers[i].freq_buf);
+        FFTW(free)(fk->workers[i].split_re);
+        FFTW(free)(fk->workers[i].split_im);
+    }
+    free(fk->workers);
+    FFTW(free)(fk->batch_time);
+    FFTW(free)(fk->batch_freq);
+    FFTW(free)(fk->split_re);
+    FFTW(free)(fk->split_im);
     free(fk->window_function);
+    free(fk->scaled_window);
     free(fk);
 }
 
-Spectrodata* fftkernel_execute_forward(const FFTKernel* fk, const Audiodata* ad) {
+void fftkernel_reserve_workers(FFTKernel* fk, size_t worker_count) {
+    if (worker_count <= fk->worker_count)
+        return;
+
+    fk->workers = realloc(fk->workers, worker_count * sizeof(FFTScratch));
+    assert(fk->workers);
+
+    for (size_t i = fk->worker_count; i < worker_count; i++) {
+        fk->workers[i].time_buf = FFTW(alloc_real)(fk->window_size);
+        assert(fk->workers[i].time_buf);
+        fk->workers[i].freq_buf = FFTW(alloc_complex)(fk->window_size / 2 + 1);
+        assert(fk->workers[i].freq_buf);
+        fk->workers[i].split_re = FFTW(alloc_real)(fk->window_size / 2 + 1);
+        assert(fk->workers[i].split_re);
+        fk->workers[i].split_im = FFTW(alloc_real)(fk->window_size / 2 + 1);
+        assert(fk->workers[i].split_im);
+    }
+    fk->worker_count = worker_count;
+}
+
+// The kernel's own buffers, for the single-threaded paths.
+static FFTScratch fftkernel_own_scratch(const FFTKernel* fk) {
+    return (FFTScratch){ .time_buf = fk->time_buf, .freq_buf = fk->freq_buf, .split_re = fk->split_re, .split_im = fk->split_im };
+}
+
+// Fills in a Spectrodata for `frames` samples of audio and allocates its bins, uninitialized. Bins it already
+// has are reused if they are big enough, so `sd` must be zeroed or hold heap bins, not mapped ones.
+static void spectrodata_init_layout(Spectrodata* sd, const FFTKernel* fk, size_t sample_rate, size_t frames, enum SpectroLayout layout) {
+    sd->sample_rate = sample_rate;
+    sd->original_length = frames;
+    sd->layout = layout;
+    free(sd->dirty);
+    sd->dirty = NULL;
+
+    sd->window_count = (frames + fk->window_size - 1) / fk->hop_size;
+    const size_t bins = (fk->window_size / 2 + 1) * sd->window_count;
+    if (layout == SPECTRO_SPLIT) {
+        pool_free(sd->data);
+        sd->data = NULL;
+        pool_reserve((void**)&sd->re, bins * sizeof(sample));
+        pool_reserve((void**)&sd->im, bins * sizeof(sample));
+    } else {
+        pool_free(sd->re);
+        pool_free(sd->im);
+        sd->re = sd->im = NULL;
+        pool_reserve((void**)&sd->data, bins * sizeof(FFTW(complex)));
+    }
+}
+
+void spectrodata_init(Spectrodata* sd, const FFTKernel* fk, size_t sample_rate, size_t frames) {
+    spectrodata_init_layout(sd, fk, sample_rate, frames, SPECTRO_INTERLEAVED);
+}
+
+void spectrodata_free_bins(Spectrodata* sd) {
+    pool_free(sd->data);
+    pool_free(sd->re);
+    pool_free(sd->im);
+    sd->data = NULL;
+    sd->re = sd->im = NULL;
+}
+
+// Dirty windows.
+// Anything that edits bins marks the windows it touched, so fftkernel_execute_reverse_dirty can redo just
+// those parts of the audio.
+void spectrodata_mark_dirty(Spectrodata* sd, size_t first, size_t last) {
+    last = MIN(last, sd->window_count);
+    if (first >= last)
+        return;
+
+    if (!sd->dirty) {
+        sd->dirty = calloc((sd->window_count + 63) / 64, sizeof(uint64_t));
+        assert(sd->dirty);
+    }
+    for (size_t w = first; w < last; w++)
+        sd->dirty[w / 64] |= (uint64_t)1 << (w % 64);
+}
+
+static bool spectrodata_is_dirty(const Spectrodata* sd, size_t w) {
+    return sd->dirty && (sd->dirty[w / 64] >> (w % 64) & 1);
+}
+
+void spectrodata_clear_dirty(Spectrodata* sd) {
+    free(sd->dirty);
+    sd->dirty = NULL;
+}
+
+// Finds the next run of dirty windows at or after `from`. Returns false if there are none.
+static bool spectrodata_next_dirty_run(const Spectrodata* sd, size_t from, size_t* first, size_t* last) {
+    if (!sd->dirty)
+        return false;
+
+    // Skip whole clean words.
+    size_t w = from;
+    while (w < sd->window_count && !spectrodata_is_dirty(sd, w)) {
+        if (w % 64 == 0 && sd->dirty[w / 64] == 0)
+            w += 64;
+        else
+            w++;
+    }
+    if (w >= sd->window_count)
+        return false;
+
+    *first = w;
+    while (w < sd->window_count && spectrodata_is_dirty(sd, w))
+        w++;
+    *last = w;
+    return true;
+}
+
+// Allocates the Spectrodata that fftkernel_execute_forward would fill for `ad`.
+static Spectrodata* spectrodata_create_for(const FFTKernel* fk, const Audiodata* ad) {
+    Spectrodata *const sd = calloc(1, sizeof(Spectrodata));
+    assert(sd);
+    spectrodata_init(sd, fk, ad->sample_rate, ad->frames);
+    return sd;
+}
+
+// One channel of audio, read in place: sample i is data[i * stride]. A channel of interleaved audio
+// has a stride of the channel count; mono audio has a stride of 1.
+typedef struct {
+    const sample* data;
+    size_t stride;
+    size_t frames;
+} ChannelView;
+
+static ChannelView channel_view(const Audiodata* ad, int channel) {
+    return (ChannelView){ .data = ad->data + channel, .stride = ad->channels, .frames = ad->frames };
+}
+
+// Copies the part of window `w` that lies inside `src` into `time_buf` while applying the window function,
+// and zero-pads the rest.
+static void fftkernel_stage_window(const FFTKernel* fk, const ChannelView* src, size_t w, sample* time_buf) {
+    const size_t start = w * fk->hop_size;
+    const size_t avail = start < src->frames ? MIN(fk->window_size, src->frames - start) : 0;
+
+    fk->window_kernel(time_buf, src->data + start * src->stride, src->stride, fk->scaled_window, avail);
+    memset(time_buf + avail, 0, (fk->window_size - avail) * sizeof(sample));
+}
+
+// Transforms a staged frame into `sptr`, one window of a Spectrodata.
+static void fftkernel_transform_window(const FFTKernel* fk, sample* time_buf, FFTW(complex)* freq_buf, FFTW(complex)* sptr) {
+    // FFTW only allows new arrays with the same alignment as the planned ones. Every other window
+    // is off by one complex when the spectrum size is odd, so those go through the scratch buffer.
+    if (FFTW(alignment_of)((sample*)sptr) == FFTW(alignment_of)((sample*)freq_buf)) {
+        FFTW(execute_dft_r2c)(fk->forward, time_buf, sptr);
+    } else {
+        FFTW(execute_dft_r2c)(fk->forward, time_buf, freq_buf);
+        memcpy(sptr, freq_buf, (fk->window_size / 2 + 1) * sizeof(FFTW(complex)));
+    }
+}
+
+// The split-complex counterpart of fftkernel_transform_window.
+static void fftkernel_transform_window_split(const FFTKernel* fk, const FFTScratch* scratch, sample* re, sample* im) {
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    if (FFTW(alignment_of)(re) == FFTW(alignment_of)(fk->split_re) && FFTW(alignment_of)(im) == FFTW(alignment_of)(fk->split_im)) {
+        FFTW(execute_split_dft_r2c)(fk->forward_split, scratch->time_buf, re, im);
+    } else {
+        FFTW(execute_split_dft_r2c)(fk->forward_split, scratch->time_buf, scratch->split_re, scratch->split_im);
+        memcpy(re, scratch->split_re, spec_size * sizeof(sample));
+        memcpy(im, scratch->split_im, spec_size * sizeof(sample));
+    }
+}
+
+// Computes windows [first, last) of `ad` into `sd`, using the given scratch. Every path into the forward
+// transform goes through here or the same staging and transform steps, so they all produce bit-identical output.
+static void fftkernel_forward_range(const FFTKernel* fk, const FFTScratch* scratch,
+                                    const ChannelView* src, Spectrodata* sd, size_t first, size_t last) {
+    TRACE_SCOPE("fft_forward");
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    for (size_t w = first; w < last; w++) {
+        // The window count is rounded up, so the last few may lie entirely past the end.
+        const bool past_end = w * fk->hop_size >= src->frames;
+        if (!past_end)
+            fftkernel_stage_window(fk, src, w, scratch->time_buf);
+
+        if (sd->layout == SPECTRO_SPLIT) {
+            sample *const re = sd->re + w * spec_size;
+            sample *const im = sd->im + w * spec_size;
+            if (past_end) {
+                memset(re, 0, spec_size * sizeof(sample));
+                memset(im, 0, spec_size * sizeof(sample));
+            } else {
+                fftkernel_transform_window_split(fk, scratch, re, im);
+            }
+        } else {
+            FFTW(complex) *const sptr = sd->data + w * spec_size;
+            if (past_end)
+                memset(sptr, 0, spec_size * sizeof(FFTW(complex)));
+            else
+                fftkernel_transform_window(fk, scratch->time_buf, scratch->freq_buf, sptr);
+        }
+    }
+}
+
+bool fftkernel_execute_forward_into(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd) {
     if (ad->channels != 1) {
         fprintf(stderr, "fftkernel_execute_forward: An Audiodata that wasn't one channel was given. It had %d channels.\n", ad->channels);
-        return NULL;
+        return false;
     }
 
+    spectrodata_init(sd, fk, ad->sample_rate, ad->frames);
+
+    const ChannelView src = channel_view(ad, 0);
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    fftkernel_forward_range(fk, &scratch, &src, sd, 0, sd->window_count);
+
+    return true;
+}
+
+Spectrodata* fftkernel_execute_forward(const FFTKernel* fk, const Audiodata* ad) {
     Spectrodata *const sd = calloc(1, sizeof(Spectrodata));
     assert(sd);
+    if (!fftkernel_execute_forward_into(fk, ad, sd)) {
+        free(sd);
+        return NULL;
+    }
+    return sd;
+}
 
-    sd->sample_rate = ad->sample_rate;
-    sd->original_length = ad->frames;
+void fftkernel_enable_batch(FFTKernel* fk, size_t batch_windows) {
+    if (batch_windows == 0)
+        batch_windows = (65536 + fk->window_size - 1) / fk->window_size;
+
+    // Keeps every batch's first window at the same alignment in sd->data, so they can all be written in place.
+    batch_windows += batch_windows % 2;
+    if (batch_windows == fk->batch_windows)
+        return;
+
+    pthread_mutex_lock(&wisdom.lock);
+    if (fk->forward_batch)
+        FFTW(destroy_plan)(fk->forward_batch);
+    pthread_mutex_unlock(&wisdom.lock);
+    FFTW(free)(fk->batch_time);
+    FFTW(free)(fk->batch_freq);
+
+    const int n = (int)fk->window_size;
+    const int spec_size = n / 2 + 1;
+
+    fk->batch_windows = batch_windows;
+    fk->batch_time = FFTW(alloc_real)(batch_windows * fk->window_size);
+    assert(fk->batch_time);
+    fk->batch_freq = FFTW(alloc_complex)(batch_windows * spec_size);
+    assert(fk->batch_freq);
+
+    pthread_mutex_lock(&wisdom.lock);
+    wisdom_load();
+    fk->forward_batch = FFTW(plan_many_dft_r2c)(1, &n, (int)batch_windows, fk->batch_time, NULL, 1, n,
+                                                fk->batch_freq, NULL, 1, spec_size, FFTW_PATIENT | FFTW_WISDOM_ONLY);
+    if (!fk->forward_batch)
+        fk->forward_batch = FFTW(plan_many_dft_r2c)(1, &n, (int)batch_windows, fk->batch_time, NULL, 1, n,
+                                                    fk->batch_freq, NULL, 1, spec_size, wisdom_miss_flags());
+    pthread_mutex_unlock(&wisdom.lock);
+    assert(fk->forward_batch);
+}
 
-    sd->window_count = (ad->frames + fk->window_size - 1) / fk->hop_size;
-    printf("Created %d windows for %d samples, %d window_size, %d hop_size.\n", sd->window_count, ad->frames, fk->window_size, fk->hop_size);
-    sd->data = calloc((fk->window_size / 2 + 1) * sd->window_count, sizeof(fftwf_complex));
-    assert(sd->data);
+Spectrodata* fftkernel_execute_forward_batched(const FFTKernel* fk, const Audiodata* ad) {
+    if (ad->channels != 1) {
+        fprintf(stderr, "fftkernel_execute_forward_batched: An Audiodata that wasn't one channel was given. It had %d channels.\n", ad->channels);
+        return NULL;
+    }
+    assert(fk->forward_batch);
+
+    Spectrodata *const sd = spectrodata_create_for(fk, ad);
+    const size_t spec_size = fk->window_size / 2 + 1;
+    const ChannelView src = channel_view(ad, 0);
+
+    for (size_t first = 0; first < sd->window_count; first += fk->batch_windows) {
+        TRACE_SCOPE("fft_forward");
+        const size_t count = MIN(fk->batch_windows, sd->window_count - first);
+        FFTW(complex) *const sptr = sd->data + first * spec_size;
 
-    fftwf_complex *sptr = sd->data;
-    const float* const aptr_end = ad->data + ad->frames;
-    const fftwf_complex* const sptr_end = sd->data + (fk->window_size / 2 + 1) * sd->window_count;
+        for (size_t i = 0; i < count; i++)
+            fftkernel_stage_window(fk, &src, first + i, fk->batch_time + i * fk->window_size);
 
-    for (const float* aptr = ad->data; aptr < aptr_end; aptr += fk->hop_size) {
-        
-        if (aptr + fk->window_size > aptr_end) {
-            memset(fk->time_buf, 0, fk->window_size);
-            memcpy(fk->time_buf, aptr, aptr_end - aptr);
+        if (count == fk->batch_windows && FFTW(alignment_of)((sample*)sptr) == FFTW(alignment_of)((sample*)fk->batch_freq)) {
+            FFTW(execute_dft_r2c)(fk->forward_batch, fk->batch_time, sptr);
         } else {
-            memcpy(fk->time_buf, aptr, fk->window_size * sizeof(float));
+            // A short last batch; whatever was left in the rest of the staging buffer gets thrown away.
+            FFTW(execute_dft_r2c)(fk->forward_batch, fk->batch_time, fk->batch_freq);
+            memcpy(sptr, fk->batch_freq, count * spec_size * sizeof(FFTW(complex)));
         }
+    }
 
-        // Hanning or whatever else
-        for (size_t i = 0; i < fk->window_size; i++) {
-            fk->time_buf[i] *= fk->window_function[i] / fk->window_size;
-        }
+    return sd;
+}
 
-        fftwf_execute(fk->forward);
+void fftkernel_enable_split(FFTKernel* fk) {
+    if (fk->forward_split)
+        return;
 
-        memcpy(sptr, fk->freq_buf, (fk->window_size / 2 + 1) * sizeof(fftwf_complex));
+    const size_t spec_size = fk->window_size / 2 + 1;
+    fk->split_re = FFTW(alloc_real)(spec_size);
+    assert(fk->split_re);
+    fk->split_im = FFTW(alloc_real)(spec_size);
+    assert(fk->split_im);
+
+    const FFTW(iodim) dim = { .n = (int)fk->window_size, .is = 1, .os = 1 };
+    pthread_mutex_lock(&wisdom.lock);
+    wisdom_load();
+    fk->forward_split = FFTW(plan_guru_split_dft_r2c)(1, &dim, 0, NULL, fk->time_buf, fk->split_re, fk->split_im,
+                                                      FFTW_PATIENT | FFTW_WISDOM_ONLY);
+    if (!fk->forward_split)
+        fk->forward_split = FFTW(plan_guru_split_dft_r2c)(1, &dim, 0, NULL, fk->time_buf, fk->split_re, fk->split_im,
+                                                          wisdom_miss_flags());
+    pthread_mutex_unlock(&wisdom.lock);
+    assert(fk->forward_split);
+}
 
-        sptr += (fk->window_size / 2 + 1);
-        if (sptr >= sptr_end) break;
+Spectrodata* fftkernel_execute_forward_split(const FFTKernel* fk, const Audiodata* ad) {
+    if (ad->channels != 1) {
+        fprintf(stderr, "fftkernel_execute_forward_split: An Audiodata that wasn't one channel was given. It had %d channels.\n", ad->channels);
+        return NULL;
     }
+    assert(fk->forward_split);
+
+    Spectrodata *const sd = calloc(1, sizeof(Spectrodata));
+    assert(sd);
+    spectrodata_init_layout(sd, fk, ad->sample_rate, ad->frames, SPECTRO_SPLIT);
 
+    const ChannelView src = channel_view(ad, 0);
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    fftkernel_forward_range(fk, &scratch, &src, sd, 0, sd->window_count);
     return sd;
 }
 
-Audiodata* fftkernel_execute_reverse(const FFTKernel* fk, const Spectrodata* sd) {
-    Audiodata *const ad = calloc(1, sizeof(Audiodata));
-    assert(ad);
-    ad->data = calloc(sd->original_length, sizeof(float));
-    assert(ad->data);
-    ad->channels = 1;
-    ad->frames = sd->original_length;
-    ad->sample_rate = sd->sample_rate;
-    
-    const size_t spec_size = fk->window_size / 2 + 1;
-    const fftwf_complex *const sptr_end = sd->data + sd->window_count * spec_size;
+void spectrodata_to_split(Spectrodata* sd, size_t spec_size) {
+    if (sd->layout == SPECTRO_SPLIT)
+        return;
+
+    const size_t bins = sd->window_count * spec_size;
+    sample* re = pool_alloc(bins * sizeof(sample));
+    sample* im = pool_alloc(bins * sizeof(sample));
 
-    float* aptr = ad->data;
-    const float* const aptr_end = ad->data + ad->frames;
-    for (const fftwf_complex* sptr = sd->data; sptr < sptr_end; sptr += spec_size) {
-        // No secondary check required because it's going to be a perfect multiple of the block size for spectrodata.
+    for (size_t i = 0; i < bins; i++) {
+        re[i] = sd->data[i][0];
+        im[i] = sd->data[i][1];
+    }
 
-        memcpy(fk->freq_buf, sptr, spec_size);
-        
-        fftwf_execute(fk->reverse);
+    pool_free(sd->data);
+    sd->data = NULL;
+    sd->re = re;
+    sd->im = im;
+    sd->layout = SPECTRO_SPLIT;
+}
 
-        // OLA algorithm
-        for (size_t i = 0; i < MIN(fk->window_size, (size_t)(aptr_end - aptr)); i++)
-            aptr[i] += fk->time_buf[i];
-        
-        aptr += fk->hop_size;
+void spectrodata_to_interleaved(Spectrodata* sd, size_t spec_size) {
+    if (sd->layout == SPECTRO_INTERLEAVED)
+        return;
+
+    const size_t bins = sd->window_count * spec_size;
+    FFTW(complex)* data = pool_alloc(bins * sizeof(FFTW(complex)));
+
+    for (size_t i = 0; i < bins; i++) {
+        data[i][0] = sd->re[i];
+        data[i][1] = sd->im[i];
     }
 
-    return ad;
+    pool_free(sd->re);
+    pool_free(sd->im);
+    sd->re = sd->im = NULL;
+    sd->data = data;
+    sd->layout = SPECTRO_INTERLEAVED;
 }
 
-void spectrodata_destroy(Spectrodata *sd) {
-    free(sd->data);
-    free(sd);
+void spectrodata_apply_mask(Spectrodata* sd, const sample* gains, size_t spec_size) {
+    if (sd->layout == SPECTRO_SPLIT) {
+        // Straight through both planes; the compiler vectorizes these.
+        for (size_t w = 0; w < sd->window_count; w++) {
+            sample *const re = sd->re + w * spec_size;
+            sample *const im = sd->im + w * spec_size;
+            for (size_t i = 0; i < spec_size; i++)
+                re[i] *= gains[i];
+            for (size_t i = 0; i < spec_size; i++)
+                im[i] *= gains[i];
+        }
+    } else {
+        for (size_t w = 0; w < sd->window_count; w++) {
+            FFTW(complex) *const sptr = sd->data + w * spec_size;
+            for (size_t i = 0; i < spec_size; i++) {
+                sptr[i][0] *= gains[i];
+                sptr[i][1] *= gains[i];
+            }
+        }
+    }
+    spectrodata_mark_dirty(sd, 0, sd->window_count);
 }
 
-#define MAIN2
-#ifdef MAIN1
-int main() {
-    printf("Hello world!");
-    FFTKernel *fk = fftkernel_create(WF_HANN, 4096, 2048);
+typedef struct {
+    const FFTKernel* fk;
+    ChannelView src;
+    Spectrodata* sd;
+    size_t task_count;
+} ForwardJob;
+
+static void forward_task(void* ctx, size_t task, size_t worker) {
+    const ForwardJob* job = ctx;
+    const FFTScratch* scratch = &job->fk->workers[worker];
+
+    const size_t first = job->sd->window_count * task / job->task_count;
+    const size_t last = job->sd->window_count * (task + 1) / job->task_count;
+    fftkernel_forward_range(job->fk, scratch, &job->src, job->sd, first, last);
+}
 
-    Audiodata *ad = audiodata_read_file("bin\\test.wav");
-    assert(ad);
+Spectrodata* fftkernel_execute_forward_parallel(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad) {
+    if (ad->channels != 1) {
+        fprintf(stderr, "fftkernel_execute_forward_parallel: An Audiodata that wasn't one channel was given. It had %d channels.\n", ad->channels);
+        return NULL;
+    }
+    assert(fk->worker_count >= pool->thread_count);
 
-    AudiodataMany *am = audiodata_split_channels(ad);
+    Spectrodata *const sd = spectrodata_create_for(fk, ad);
 
-    Spectrodata *sd = fftkernel_execute_forward(fk, &am->data[0]);
-    assert(sd);
+    // A few chunks per worker, so one slow thread doesn't hold everyone else up at the end.
+    ForwardJob job = {
+        .fk = fk,
+        .src = channel_view(ad, 0),
+        .sd = sd,
+        .task_count = MIN(pool->thread_count * 4, sd->window_count),
+    };
+    if (job.task_count > 0)
+        threadpool_run(pool, forward_task, &job, job.task_count);
 
-    Audiodata *ad2 = fftkernel_execute_reverse(fk, sd);
-    assert(ad2);
+    return sd;
+}
 
-    printf("Got here.\n");
-    audiodata_write_file("bin\\test_out.wav", ad2);
+// Incremental forward.
+// After an edit to the audio, only the windows that can see the changed samples need transforming again.
+// Insertions and deletions also move every later window; when they move by whole hops those windows are the
+// same bins at a new index, so they are shifted instead of recomputed.
 
-    audiodata_destroy(ad);
-    audiodata_many_destroy(am);
-    fftkernel_destroy(fk);
-    spectrodata_destroy(sd);
+void fftkernel_windows_touching(const FFTKernel* fk, size_t window_count, size_t start, size_t end, size_t* first, size_t* last) {
+    *first = start < fk->window_size ? 0 : (start - fk->window_size) / fk->hop_size + 1;
+    *last = MIN(window_count, (end + fk->hop_size - 1) / fk->hop_size);
+    if (*first > *last)
+        *first = *last;
+}
 
-    return 0;
+static void spectrodata_clean_range(Spectrodata* sd, size_t first, size_t last) {
+    if (!sd->dirty)
+        return;
+    for (size_t w = first; w < last; w++)
+        sd->dirty[w / 64] &= ~((uint64_t)1 << (w % 64));
 }
-#endif
 
-#ifdef MAIN2
-int main() {
-    printf("Hello world!");
-    FFTKernel *fk = fftkernel_create(WF_HANN, 4096, 2048);
+size_t fftkernel_update_forward(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd, size_t start, size_t end) {
+    if (ad->channels != 1 || ad->frames != sd->original_length) {
+        fprintf(stderr, "fftkernel_update_forward: The Audiodata doesn't match the Spectrodata.\n");
+        return 0;
+    }
+
+    size_t first, last;
+    fftkernel_windows_touching(fk, sd->window_count, start, MIN(end, ad->frames), &first, &last);
 
-    Spectrodata sd = {
-        .data = calloc(1000 * (fk->window_size / 2 + 1), sizeof(fftwf_complex)),
-        .original_length = 100 * (fk->window_size),
-        .sample_rate = 44100,
-        .window_count = 1000
-    };
+    const ChannelView src = channel_view(ad, 0);
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    fftkernel_forward_range(fk, &scratch, &src, sd, first, last);
+    spectrodata_clean_range(sd, first, last);
+    return last - first;
+}
+
+// Moves `count` windows from index `from` to index `to`. The ranges may overlap.
+static void spectrodata_move_windows(Spectrodata* sd, size_t spec_size, size_t to, size_t from, size_t count) {
+    if (sd->layout == SPECTRO_SPLIT) {
+        memmove(sd->re + to * spec_size, sd->re + from * spec_size, count * spec_size * sizeof(sample));
+        memmove(sd->im + to * spec_size, sd->im + from * spec_size, count * spec_size * sizeof(sample));
+    } else {
+        memmove(sd->data + to * spec_size, sd->data + from * spec_size, count * spec_size * sizeof(FFTW(complex)));
+    }
+}
+
+// Makes room for `window_count` windows, keeping the ones that fit. The bins must be on the heap, not mapped.
+static void spectrodata_resize_windows(Spectrodata* sd, size_t spec_size, size_t window_count) {
+    const size_t keep = MIN(window_count, sd->window_count) * spec_size;
+    const size_t bins = window_count * spec_size;
+    if (sd->layout == SPECTRO_SPLIT) {
+        sample* re = pool_alloc(bins * sizeof(sample));
+        sample* im = pool_alloc(bins * sizeof(sample));
+        memcpy(re, sd->re, keep * sizeof(sample));
+        memcpy(im, sd->im, keep * sizeof(sample));
+        spectrodata_free_bins(sd);
+        sd->re = re;
+        sd->im = im;
+    } else {
+        FFTW(complex)* data = pool_alloc(bins * sizeof(FFTW(complex)));
+        memcpy(data, sd->data, keep * sizeof(FFTW(complex)));
+        spectrodata_free_bins(sd);
+        sd->data = data;
+    }
+
+    if (sd->dirty) {
+        uint64_t* dirty = calloc((window_count + 63) / 64, sizeof(uint64_t));
+        assert(dirty);
+        memcpy(dirty, sd->dirty, (MIN(window_count, sd->window_count) + 63) / 64 * sizeof(uint64_t));
+        free(sd->dirty);
+        sd->dirty = dirty;
+    }
+    sd->window_count = window_count;
+}
+
+size_t fftkernel_update_forward_resized(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd,
+                                        size_t at, size_t removed, size_t inserted) {
+    if (ad->channels != 1 || ad->frames + removed != sd->original_length + inserted || at + inserted > ad->frames) {
+        fprintf(stderr, "fftkernel_update_forward_resized: The Audiodata doesn't match the Spectrodata and edit.\n");
+        return 0;
+    }
+
+    const size_t spec_size = fk->window_size / 2 + 1;
+    const size_t old_count = sd->window_count;
+    const size_t new_count = (ad->frames + fk->window_size - 1) / fk->hop_size;
+
+    // Windows from `first` on see the edit, and from `shifted` on see only samples after it (new indices).
+    // Everything before `first` is unchanged.
+    size_t first, shifted;
+    fftkernel_windows_touching(fk, new_count, at, at + (inserted > 0 ? inserted : 1), &first, &shifted);
+
+    // Where the windows at `shifted` used to be.
+    size_t old_shifted = shifted;
+    if (inserted >= removed && (inserted - removed) % fk->hop_size == 0)
+        old_shifted = shifted - (inserted - removed) / fk->hop_size;
+    else if (inserted < removed && (removed - inserted) % fk->hop_size == 0)
+        old_shifted = shifted + (removed - inserted) / fk->hop_size;
+    else
+        shifted = old_shifted = new_count;
+    const size_t moved = new_count - shifted;
+
+    if (new_count > old_count) {
+        spectrodata_resize_windows(sd, spec_size, new_count);
+        spectrodata_move_windows(sd, spec_size, shifted, old_shifted, moved);
+    } else {
+        spectrodata_move_windows(sd, spec_size, shifted, old_shifted, moved);
+        sd->window_count = new_count;
+    }
+
+    // The dirty bits move with their windows, in whichever direction doesn't overwrite bits still to be read.
+    if (sd->dirty && shifted != old_shifted) {
+        for (size_t i = 0; i < moved; i++) {
+            const size_t w = shifted > old_shifted ? new_count - 1 - i : shifted + i;
+            const uint64_t bit = (uint64_t)1 << (w % 64);
+            if (spectrodata_is_dirty(sd, w - shifted + old_shifted))
+                sd->dirty[w / 64] |= bit;
+            else
+                sd->dirty[w / 64] &= ~bit;
+        }
+    }
+    sd->original_length = ad->frames;
+
+    const ChannelView src = channel_view(ad, 0);
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    fftkernel_forward_range(fk, &scratch, &src, sd, first, shifted);
+    spectrodata_clean_range(sd, first, shifted);
+    // Bits past the new end would come back if the spectrogram grew again.
+    spectrodata_clean_range(sd, new_count, (new_count + 63) / 64 * 64);
+    return shifted - first;
+}
+
+// Streaming input.
+// Pulls a file through a small ring buffer per channel instead of reading it all up front, and hands the bins
+// to a sink a few windows at a time instead of keeping them, so memory use depends on the window size and
+// channel count but not on how long the file is.
+struct AudioStream {
+    SNDFILE* sndfile;
+    SF_INFO info;
+
+    // Interleaved, block_frames frames. Each read from the file is at most this big.
+    sample* block;
+    size_t block_frames;
+
+    // One ring of ring_size samples per channel, back to back. Frame f of channel c lives at
+    // rings[c * ring_size + (f & (ring_size - 1))]; the rings always hold the frames just before frames_read.
+    sample* rings;
+    size_t ring_size;
+    size_t frames_read;
+};
+
+AudioStream* audiostream_open(const char* fname, const FFTKernel* fk) {
+    SF_INFO sfinfo = {};
+
+    SNDFILE *sndfile = sf_open(fname, SFM_READ, &sfinfo);
+    if (!sndfile) {
+        fprintf(stderr, "Error opening audio file '%s': %s\n", fname, sf_strerror(NULL));
+        return NULL;
+    }
+
+    AudioStream* as = calloc(1, sizeof(AudioStream));
+    assert(as);
+    as->sndfile = sndfile;
+    as->info = sfinfo;
+
+    // A few hops per read keeps the syscall count down without making the buffers file-sized.
+    as->block_frames = 4 * fk->hop_size;
+    as->block = calloc(as->block_frames * sfinfo.channels, sizeof(sample));
+    assert(as->block);
 
-    /*for (int i = 0; i < 1000; i++) {
-        sd.data[100 + i * (fk->window_size / 2 + 1)][0] = 0.001f;  // real part
-        sd.data[100 + i * (fk->window_size / 2 + 1)][1] = 0.0f;  // imag part
-    }*/
+    // Room for a whole window plus the block being read in after it.
+    as->ring_size = 1;
+    while (as->ring_size < fk->window_size + as->block_frames)
+        as->ring_size *= 2;
+    as->rings = calloc(as->ring_size * sfinfo.channels, sizeof(sample));
+    assert(as->rings);
 
-    Audiodata *ad2 = fftkernel_execute_reverse(fk, &sd);
-    assert(ad2);
+    return as;
+}
+
+void audiostream_close(AudioStream* as) {
+    sf_close(as->sndfile);
+    free(as->block);
+    free(as->rings);
+    free(as);
+}
+
+// Reads until frame `end` (exclusive) is in the rings. A file that comes up short reads as silence,
+// the same as it does in audiodata_read_file.
+static void audiostream_fill(AudioStream* as, size_t end) {
+    const int channels = as->info.channels;
+    const size_t mask = as->ring_size - 1;
+
+    while (as->frames_read < end) {
+        TRACE_SCOPE("read_audio");
+        const size_t want = MIN(as->block_frames, (size_t)as->info.frames - as->frames_read);
+        sf_count_t got = sf_readf_sample(as->sndfile, as->block, want, channels);
+        if (got < 0)
+            got = 0;
+        memset(as->block + got * channels, 0, (want - got) * channels * sizeof(sample));
+
+        for (size_t i = 0; i < want; i++) {
+            const size_t pos = (as->frames_read + i) & mask;
+            for (int c = 0; c < channels; c++)
+                as->rings[c * as->ring_size + pos] = as->block[i * channels + c];
+        }
+        as->frames_read += want;
+    }
+}
+
+// The streaming counterpart of fftkernel_stage_window, for one channel.
+static void fftkernel_stage_stream_window(const FFTKernel* fk, const AudioStream* as, int channel, size_t w, sample* time_buf) {
+    const size_t start = w * fk->hop_size;
+    const size_t avail = MIN(fk->window_size, (size_t)as->info.frames - start);
+    const sample* ring = as->rings + channel * as->ring_size;
+
+    // The window may wrap around the end of the ring.
+    const size_t pos = start & (as->ring_size - 1);
+    const size_t head = MIN(avail, as->ring_size - pos);
+    fk->window_kernel(time_buf, ring + pos, 1, fk->scaled_window, head);
+    fk->window_kernel(time_buf + head, ring, 1, fk->scaled_window + head, avail - head);
+    memset(time_buf + avail, 0, (fk->window_size - avail) * sizeof(sample));
+}
+
+void fftkernel_forward_stream_to(const FFTKernel* fk, AudioStream* as, SpectroSink sink, void* ctx) {
+    const int channels = as->info.channels;
+    const size_t frames = as->info.frames;
+    const size_t spec_size = fk->window_size / 2 + 1;
+    const size_t window_count = (frames + fk->window_size - 1) / fk->hop_size;
+
+    // As many windows as one read from the file brings in.
+    const size_t block_windows = MAX(as->block_frames / fk->hop_size, 1);
+    FFTW(complex)* bins = FFTW(malloc)(channels * block_windows * spec_size * sizeof(FFTW(complex)));
+    assert(bins);
+
+    for (size_t first = 0; first < window_count; first += block_windows) {
+        const size_t count = MIN(block_windows, window_count - first);
+        for (size_t i = 0; i < count; i++) {
+            const size_t w = first + i;
+            const size_t start = w * fk->hop_size;
+
+            // The window count is rounded up, so the last few may lie entirely past the end.
+            if (start >= frames) {
+                for (int c = 0; c < channels; c++)
+                    memset(bins + (c * block_windows + i) * spec_size, 0, spec_size * sizeof(FFTW(complex)));
+                continue;
+            }
+
+            audiostream_fill(as, MIN(start + fk->window_size, frames));
+            TRACE_SCOPE("fft_forward");
+            for (int c = 0; c < channels; c++) {
+                fftkernel_stage_stream_window(fk, as, c, w, fk->time_buf);
+                fftkernel_transform_window(fk, fk->time_buf, fk->freq_buf, bins + (c * block_windows + i) * spec_size);
+            }
+        }
 
-    printf("Got here.\n");
-    audiodata_write_file("bin\\test_out.wav", ad2);
+        for (int c = 0; c < channels; c++)
+            sink(ctx, c, first, count, bins + c * block_windows * spec_size);
+    }
+
+    FFTW(free)(bins);
+}
 
-    fftkernel_destroy(fk);
+typedef struct {
+    SpectrodataMany* sm;
+    size_t spec_size;
+} StreamCollect;
 
-    return 0;
+static void stream_collect_sink(void* ctx, int channel, size_t first, size_t count, const FFTW(complex)* bins) {
+    const StreamCollect* collect = ctx;
+    memcpy(collect->sm->data[channel].data + first * collect->spec_size, bins, count * collect->spec_size * sizeof(FFTW(complex)));
+}
+
+SpectrodataMany* fftkernel_execute_forward_stream(const FFTKernel* fk, AudioStream* as) {
+    const int channels = as->info.channels;
+
+    SpectrodataMany* sm = calloc(1, sizeof(SpectrodataMany));
+    assert(sm);
+    sm->count = channels;
+    sm->data = calloc(channels, sizeof(Spectrodata));
+    assert(sm->data);
+    for (int c = 0; c < channels; c++)
+        spectrodata_init(&sm->data[c], fk, as->info.samplerate, as->info.frames);
+
+    StreamCollect collect = { .sm = sm, .spec_size = fk->window_size / 2 + 1 };
+    fftkernel_forward_stream_to(fk, as, stream_collect_sink, &collect);
+    return sm;
+}
+
+// Live input.
+// The audio thread pushes blocks of any size into a single-producer, single-consumer ring, and an analysis
+// thread takes windows out of it. A window comes out as soon as its last sample is in, so no sample waits more
+// than window_size frames. Pushing only copies into the ring and publishes the new head: no locks, no
+// allocation, and it never waits on the analysis thread.
+LiveAnalyzer* live_analyzer_create(const FFTKernel* fk, int channels, size_t max_block) {
+    if (channels <= 0 || max_block == 0) {
+        fprintf(stderr, "A live analyzer needs at least one channel and a nonzero block size.\n");
+        return NULL;
+    }
+
+    LiveAnalyzer* la = calloc(1, sizeof(LiveAnalyzer));
+    assert(la);
+    la->fk = fk;
+    la->channels = channels;
+
+    // A whole window (or hop, if that is longer) waiting to go out, plus a block arriving behind it.
+    la->capacity = 1;
+    while (la->capacity < (fk->window_size > fk->hop_size ? fk->window_size : fk->hop_size) + max_block)
+        la->capacity *= 2;
+    la->ring = calloc(la->capacity * channels, sizeof(sample));
+    assert(la->ring);
+
+    atomic_init(&la->head, 0);
+    atomic_init(&la->dropped, 0);
+    atomic_init(&la->finished, false);
+    atomic_init(&la->tail, 0);
+    return la;
+}
+
+void live_analyzer_destroy(LiveAnalyzer* la) {
+    free(la->ring);
+    free(la);
+}
+
+size_t live_analyzer_push(LiveAnalyzer* la, const sample* block, size_t frames) {
+    const size_t head = atomic_load_explicit(&la->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&la->tail, memory_order_acquire);
+    const size_t count = MIN(frames, la->capacity - (head - tail));
+
+    const size_t pos = head & (la->capacity - 1);
+    const size_t first = MIN(count, la->capacity - pos);
+    memcpy(la->ring + pos * la->channels, block, first * la->channels * sizeof(sample));
+    memcpy(la->ring, block + first * la->channels, (count - first) * la->channels * sizeof(sample));
+
+    atomic_store_explicit(&la->head, head + count, memory_order_release);
+    if (count < frames)
+        atomic_fetch_add_explicit(&la->dropped, frames - count, memory_order_relaxed);
+    return count;
+}
+
+size_t live_analyzer_space(LiveAnalyzer* la) {
+    const size_t head = atomic_load_explicit(&la->head, memory_order_relaxed);
+    return la->capacity - (head - atomic_load_explicit(&la->tail, memory_order_acquire));
+}
+
+void live_analyzer_finish(LiveAnalyzer* la) {
+    atomic_store_explicit(&la->finished, true, memory_order_release);
+}
+
+bool live_analyzer_poll(LiveAnalyzer* la, FFTW(complex)* out) {
+    const FFTKernel* fk = la->fk;
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    // Read finished before head: once it's set, head is final.
+    const bool finished = atomic_load_explicit(&la->finished, memory_order_acquire);
+    const size_t head = atomic_load_explicit(&la->head, memory_order_acquire);
+    const size_t start = la->windows_emitted * fk->hop_size;
+
+    // Frames before the next window are no longer needed. With a hop longer than the window, some of those
+    // may not have arrived yet, so they are let go of as they come in.
+    atomic_store_explicit(&la->tail, MIN(start, head), memory_order_release);
+
+    if (finished) {
+        if (la->windows_emitted >= (head + fk->window_size - 1) / fk->hop_size)
+            return false;
+    } else if (head < start + fk->window_size) {
+        return false;
+    }
+
+    TRACE_SCOPE("fft_forward");
+    const size_t avail = start < head ? MIN(fk->window_size, head - start) : 0;
+    const size_t pos = start & (la->capacity - 1);
+    const size_t first = MIN(avail, la->capacity - pos);
+    for (int c = 0; c < la->channels; c++) {
+        FFTW(complex) *const sptr = out + c * spec_size;
+        if (avail == 0) {
+            memset(sptr, 0, spec_size * sizeof(FFTW(complex)));
+            continue;
+        }
+
+        // The window may wrap around the end of the ring.
+        fk->window_kernel(fk->time_buf, la->ring + pos * la->channels + c, la->channels, fk->scaled_window, first);
+        fk->window_kernel(fk->time_buf + first, la->ring + c, la->channels, fk->scaled_window + first, avail - first);
+        memset(fk->time_buf + avail, 0, (fk->window_size - avail) * sizeof(sample));
+        fftkernel_transform_window(fk, fk->time_buf, fk->freq_buf, sptr);
+    }
+
+    // How far the input had got past this window's last sample by the time it went out.
+    const size_t end = start + fk->window_size;
+    if (!finished && head - end > la->max_lag)
+        la->max_lag = head - end;
+
+    la->windows_emitted++;
+    atomic_store_explicit(&la->tail, MIN(la->windows_emitted * fk->hop_size, head), memory_order_release);
+    return true;
+}
+
+// How many windows at the start of a range overlap the last window of the range before it.
+static size_t fftkernel_seam_windows(const FFTKernel* fk) {
+    return (fk->window_size - 1) / fk->hop_size;
+}
+
+// Where the last window before `first` ends; the samples before this belong to the previous range.
+static size_t fftkernel_seam_end(const FFTKernel* fk, const Audiodata* ad, size_t first) {
+    if (first == 0)
+        return 0;
+    return MIN((first - 1) * fk->hop_size + fk->window_size, ad->frames);
+}
+
+// Inverts windows [first, last) of `sd` and overlap-adds them into `ad`, which must start zeroed.
+// Samples before fftkernel_seam_end are not touched; instead, each window's part of them is stored
+// in `seam_buf` (window_size floats per window) for fftkernel_reverse_seam to add later. This way
+// every range writes a disjoint slice of the output, and each sample is still summed in window order.
+static void fftkernel_reverse_range(const FFTKernel* fk, const FFTScratch* scratch,
+                                    const Spectrodata* sd, Audiodata* ad, size_t first, size_t last, sample* seam_buf) {
+    TRACE_SCOPE("ifft_ola");
+    sample *const time_buf = scratch->time_buf;
+    FFTW(complex) *const freq_buf = scratch->freq_buf;
+    const size_t spec_size = fk->window_size / 2 + 1;
+    const size_t seam_end = fftkernel_seam_end(fk, ad, first);
+
+    for (size_t w = first; w < last; w++) {
+        const size_t start = w * fk->hop_size;
+        if (start >= ad->frames)
+            break;
+
+        // c2r destroys its input, so it can't run on sd->data directly. Split spectra get interleaved on the way.
+        if (sd->layout == SPECTRO_SPLIT) {
+            const sample* re = sd->re + w * spec_size;
+            const sample* im = sd->im + w * spec_size;
+            for (size_t i = 0; i < spec_size; i++) {
+                freq_buf[i][0] = re[i];
+                freq_buf[i][1] = im[i];
+            }
+        } else {
+            memcpy(freq_buf, sd->data + w * spec_size, spec_size * sizeof(FFTW(complex)));
+        }
+        FFTW(execute_dft_c2r)(fk->reverse, freq_buf, time_buf);
+
+        const size_t end = MIN(start + fk->window_size, ad->frames);
+        size_t i = start;
+        if (i < seam_end) {
+            memcpy(seam_buf + (w - first) * fk->window_size, time_buf, (seam_end - i) * sizeof(sample));
+            i = seam_end;
+        }
+
+        // OLA algorithm
+        for (; i < end; i++)
+            ad->data[i] += time_buf[i - start];
+    }
+}
+
+// Adds the seam stored by fftkernel_reverse_range for the range starting at `first`. The previous range
+// must be finished, so its windows come before these ones in each sample's sum.
+static void fftkernel_reverse_seam(const FFTKernel* fk, Audiodata* ad, size_t first, const sample* seam_buf) {
+    TRACE_SCOPE("ola_seam");
+    const size_t seam_end = fftkernel_seam_end(fk, ad, first);
+
+    for (size_t w = first; w * fk->hop_size < seam_end; w++) {
+        const sample* frame = seam_buf + (w - first) * fk->window_size;
+        const size_t start = w * fk->hop_size;
+        for (size_t i = start; i < seam_end; i++)
+            ad->data[i] += frame[i - start];
+    }
+}
+
+// Sets `ad` up as zeroed mono audio for `sd`, reusing its samples if they are big enough.
+static void audiodata_init_for(Audiodata* ad, const Spectrodata* sd) {
+    pool_reserve((void**)&ad->data, sd->original_length * sizeof(sample));
+    memset(ad->data, 0, sd->original_length * sizeof(sample));
+    ad->channels = 1;
+    ad->frames = sd->original_length;
+    ad->sample_rate = sd->sample_rate;
+}
+
+static Audiodata* audiodata_create_for(const Spectrodata* sd) {
+    Audiodata *const ad = calloc(1, sizeof(Audiodata));
+    assert(ad);
+    audiodata_init_for(ad, sd);
+    return ad;
+}
+
+void fftkernel_execute_reverse_into(const FFTKernel* fk, const Spectrodata* sd, Audiodata* ad) {
+    audiodata_init_for(ad, sd);
+
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    fftkernel_reverse_range(fk, &scratch, sd, ad, 0, sd->window_count, NULL);
+}
+
+Audiodata* fftkernel_execute_reverse(const FFTKernel* fk, const Spectrodata* sd) {
+    Audiodata *const ad = calloc(1, sizeof(Audiodata));
+    assert(ad);
+    fftkernel_execute_reverse_into(fk, sd, ad);
+    return ad;
+}
+
+typedef struct {
+    const FFTKernel* fk;
+    const Spectrodata* sd;
+    Audiodata* ad;
+    size_t task_count;
+    size_t seam_windows;
+    sample* seams;
+} ReverseJob;
+
+static size_t reverse_job_first(const ReverseJob* job, size_t task) {
+    return job->sd->window_count * task / job->task_count;
+}
+
+static sample* reverse_job_seam(const ReverseJob* job, size_t task) {
+    return job->seams + task * job->seam_windows * job->fk->window_size;
+}
+
+static void reverse_task(void* ctx, size_t task, size_t worker) {
+    const ReverseJob* job = ctx;
+    const FFTScratch* scratch = &job->fk->workers[worker];
+
+    fftkernel_reverse_range(job->fk, scratch, job->sd, job->ad,
+                            reverse_job_first(job, task), reverse_job_first(job, task + 1), reverse_job_seam(job, task));
+}
+
+static void reverse_seam_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    const ReverseJob* job = ctx;
+    if (task > 0)
+        fftkernel_reverse_seam(job->fk, job->ad, reverse_job_first(job, task), reverse_job_seam(job, task));
+}
+
+// Splits `sd` into at most `max_tasks` ranges for reverse_task.
+static void reverse_job_init(ReverseJob* job, const FFTKernel* fk, const Spectrodata* sd, Audiodata* ad, size_t max_tasks) {
+    // Ranges have to be at least as long as their seam, or a seam would reach back past its neighbour.
+    const size_t seam_windows = fftkernel_seam_windows(fk);
+    size_t task_count = MIN(max_tasks, sd->window_count / (seam_windows > 0 ? seam_windows : 1));
+    if (task_count == 0)
+        task_count = 1;
+
+    *job = (ReverseJob){
+        .fk = fk,
+        .sd = sd,
+        .ad = ad,
+        .task_count = task_count,
+        .seam_windows = seam_windows,
+        .seams = NULL,
+    };
+    if (task_count > 1 && seam_windows > 0) {
+        job->seams = FFTW(alloc_real)(task_count * seam_windows * fk->window_size);
+        assert(job->seams);
+    }
+}
+
+Audiodata* fftkernel_execute_reverse_parallel(const FFTKernel* fk, ThreadPool* pool, const Spectrodata* sd) {
+    assert(fk->worker_count >= pool->thread_count);
+
+    Audiodata *const ad = audiodata_create_for(sd);
+
+    ReverseJob job;
+    reverse_job_init(&job, fk, sd, ad, pool->thread_count);
+
+    threadpool_run(pool, reverse_task, &job, job.task_count);
+    threadpool_run(pool, reverse_seam_task, &job, job.task_count);
+
+    FFTW(free)(job.seams);
+    return ad;
+}
+
+// Rewrites samples [span_start, span_end) of `ad` from every window that overlaps them, summing in window
+// order from zero, exactly as fftkernel_execute_reverse would have.
+static void fftkernel_reverse_span(const FFTKernel* fk, const FFTScratch* scratch,
+                                   const Spectrodata* sd, Audiodata* ad, size_t span_start, size_t span_end) {
+    TRACE_SCOPE("ifft_ola");
+    size_t first, last;
+    fftkernel_windows_touching(fk, sd->window_count, span_start, span_end, &first, &last);
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    memset(ad->data + span_start, 0, (span_end - span_start) * sizeof(sample));
+    for (size_t w = first; w < last; w++) {
+        if (sd->layout == SPECTRO_SPLIT) {
+            const sample* re = sd->re + w * spec_size;
+            const sample* im = sd->im + w * spec_size;
+            for (size_t i = 0; i < spec_size; i++) {
+                scratch->freq_buf[i][0] = re[i];
+                scratch->freq_buf[i][1] = im[i];
+            }
+        } else {
+            memcpy(scratch->freq_buf, sd->data + w * spec_size, spec_size * sizeof(FFTW(complex)));
+        }
+        FFTW(execute_dft_c2r)(fk->reverse, scratch->freq_buf, scratch->time_buf);
+
+        const size_t start = w * fk->hop_size;
+        const size_t from = start > span_start ? start : span_start;
+        const size_t to = MIN(start + fk->window_size, span_end);
+        for (size_t i = from; i < to; i++)
+            ad->data[i] += scratch->time_buf[i - start];
+    }
+}
+
+size_t fftkernel_execute_reverse_dirty(const FFTKernel* fk, Spectrodata* sd, Audiodata* ad) {
+    if (ad->channels != 1 || ad->frames != sd->original_length) {
+        fprintf(stderr, "fftkernel_execute_reverse_dirty: The Audiodata doesn't match the Spectrodata.\n");
+        return 0;
+    }
+
+    const FFTScratch scratch = fftkernel_own_scratch(fk);
+    size_t rewritten = 0;
+
+    size_t first, last, from = 0;
+    bool more = spectrodata_next_dirty_run(sd, from, &first, &last);
+    while (more) {
+        // Runs whose samples meet are done together, otherwise the second would zero what the first summed.
+        const size_t span_start = MIN(first * fk->hop_size, ad->frames);
+        size_t span_end = MIN((last - 1) * fk->hop_size + fk->window_size, ad->frames);
+        while ((more = spectrodata_next_dirty_run(sd, last, &first, &last)) && first * fk->hop_size <= span_end)
+            span_end = MIN((last - 1) * fk->hop_size + fk->window_size, ad->frames);
+
+        if (span_start < span_end) {
+            fftkernel_reverse_span(fk, &scratch, sd, ad, span_start, span_end);
+            rewritten += span_end - span_start;
+        }
+    }
+
+    spectrodata_clear_dirty(sd);
+    return rewritten;
+}
+
+// Multichannel.
+// Every channel is split into ranges like the single-channel parallel paths, and all the ranges of all the
+// channels go into one batch, so a stereo file on 16 cores still keeps all of them busy. Plans are shared;
+// scratch is per worker, as usual.
+typedef struct {
+    void* jobs;
+    size_t job_size;
+    size_t tasks_per_channel;
+    PoolTask task;
+} ManyJob;
+
+static void many_task(void* ctx, size_t task, size_t worker) {
+    const ManyJob* many = ctx;
+    void* job = (char*)many->jobs + task / many->tasks_per_channel * many->job_size;
+    many->task(job, task % many->tasks_per_channel, worker);
+}
+
+static void many_run(ThreadPool* pool, void* jobs, size_t job_size, int count, size_t tasks_per_channel, PoolTask task) {
+    ManyJob many = {
+        .jobs = jobs,
+        .job_size = job_size,
+        .tasks_per_channel = tasks_per_channel,
+        .task = task,
+    };
+    if (count > 0 && tasks_per_channel > 0)
+        threadpool_run(pool, many_task, &many, count * tasks_per_channel);
+}
+
+SpectrodataMany* fftkernel_execute_forward_many(const FFTKernel* fk, ThreadPool* pool, const AudiodataMany* am) {
+    assert(fk->worker_count >= pool->thread_count);
+
+    SpectrodataMany* sm = calloc(1, sizeof(SpectrodataMany));
+    assert(sm);
+    sm->count = am->count;
+    sm->data = calloc(am->count, sizeof(Spectrodata));
+    assert(sm->data);
+
+    ForwardJob* jobs = calloc(am->count, sizeof(ForwardJob));
+    assert(jobs);
+
+    for (int c = 0; c < am->count; c++) {
+        if (am->data[c].channels != 1 || am->data[c].frames != am->data[0].frames) {
+            fprintf(stderr, "fftkernel_execute_forward_many: Channel %d isn't a mono Audiodata as long as the others.\n", c);
+            for (int i = 0; i < c; i++)
+                spectrodata_free_bins(&sm->data[i]);
+            free(jobs);
+            free(sm->data);
+            free(sm);
+            return NULL;
+        }
+
+        spectrodata_init(&sm->data[c], fk, am->data[c].sample_rate, am->data[c].frames);
+        jobs[c] = (ForwardJob){ .fk = fk, .src = channel_view(&am->data[c], 0), .sd = &sm->data[c] };
+    }
+
+    // All channels have the same length, so they all get the same number of chunks.
+    const size_t tasks_per_channel = am->count > 0
+        ? MIN((pool->thread_count * 4 + am->count - 1) / am->count, sm->data[0].window_count) : 0;
+    for (int c = 0; c < am->count; c++)
+        jobs[c].task_count = tasks_per_channel;
+
+    many_run(pool, jobs, sizeof(ForwardJob), am->count, tasks_per_channel, forward_task);
+
+    free(jobs);
+    return sm;
+}
+
+AudiodataMany* fftkernel_execute_reverse_many(const FFTKernel* fk, ThreadPool* pool, const SpectrodataMany* sm) {
+    assert(fk->worker_count >= pool->thread_count);
+
+    AudiodataMany* am = calloc(1, sizeof(AudiodataMany));
+    assert(am);
+    am->count = sm->count;
+    am->data = calloc(sm->count, sizeof(Audiodata));
+    assert(am->data);
+
+    ReverseJob* jobs = calloc(sm->count, sizeof(ReverseJob));
+    assert(jobs);
+
+    for (int c = 0; c < sm->count; c++) {
+        assert(sm->data[c].window_count == sm->data[0].window_count);
+
+        Audiodata* ad = audiodata_create_for(&sm->data[c]);
+        am->data[c] = *ad;
+        free(ad);
+
+        reverse_job_init(&jobs[c], fk, &sm->data[c], &am->data[c], (pool->thread_count + sm->count - 1) / sm->count);
+    }
+
+    const size_t tasks_per_channel = sm->count > 0 ? jobs[0].task_count : 0;
+    many_run(pool, jobs, sizeof(ReverseJob), sm->count, tasks_per_channel, reverse_task);
+    many_run(pool, jobs, sizeof(ReverseJob), sm->count, tasks_per_channel, reverse_seam_task);
+
+    for (int c = 0; c < sm->count; c++)
+        FFTW(free)(jobs[c].seams);
+    free(jobs);
+    return am;
+}
+
+SpectrodataMany* fftkernel_execute_forward_interleaved(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad) {
+    assert(fk->worker_count >= pool->thread_count);
+
+    SpectrodataMany* sm = calloc(1, sizeof(SpectrodataMany));
+    assert(sm);
+    sm->count = ad->channels;
+    sm->data = calloc(ad->channels, sizeof(Spectrodata));
+    assert(sm->data);
+
+    ForwardJob* jobs = calloc(ad->channels, sizeof(ForwardJob));
+    assert(jobs);
+
+    for (int c = 0; c < ad->channels; c++) {
+        spectrodata_init(&sm->data[c], fk, ad->sample_rate, ad->frames);
+        jobs[c] = (ForwardJob){ .fk = fk, .src = channel_view(ad, c), .sd = &sm->data[c] };
+    }
+
+    const size_t tasks_per_channel = ad->channels > 0
+        ? MIN((pool->thread_count * 4 + ad->channels - 1) / ad->channels, sm->data[0].window_count) : 0;
+    for (int c = 0; c < ad->channels; c++)
+        jobs[c].task_count = tasks_per_channel;
+
+    many_run(pool, jobs, sizeof(ForwardJob), ad->channels, tasks_per_channel, forward_task);
+
+    free(jobs);
+    return sm;
+}
+
+// Phase vocoder.
+// Time-stretching and pitch-shifting. Each window is taken at the kernel's hop and put back at a different
+// synthesis hop, with its phases advanced to match. Only the phases of spectral peaks are tracked; the bins
+// around each peak keep their phase relative to it (identity phase locking, Laroche and Dolson 1999), which keeps
+// partials coherent and costs a complex multiply per bin rather than an atan2. A pitch shift stretches by the
+// pitch ratio as well, and then resamples the result back to the stretched length.
+// The input starts with window_size - hop_size zeros, and the output is normalized by the squared windows of
+// just the frames that saw real input at each point, so the first and last window don't fade in and out. The
+// output before the frame centred on the first real sample is dropped, which keeps it lined up with the input.
+struct PhaseVocoder {
+    const FFTKernel* fk;
+    size_t synthesis_hop;
+
+    // The pitch ratio, which is also the resampling step in vocoder samples per output sample. 1 means no resampling.
+    double pitch;
+
+    // Scratch, allocated like the kernel's so the plans can run on it from any thread.
+    sample* time_buf;
+    FFTW(complex)* freq_buf;
+
+    // The window being filled, starting at input frame windows * hop_size - (window_size - hop_size).
+    sample* input;
+    size_t input_fill;
+
+    // Where the real input ends, counting the zeros in front of it. SIZE_MAX until vocoder_finish.
+    size_t input_end;
+
+    // How many more synthesized samples to drop before the output starts.
+    size_t lead_in;
+
+    // The previous window's bins before and after its phases were changed.
+    FFTW(complex)* prev_in;
+    FFTW(complex)* prev_out;
+
+    // Per bin: |X|^2, the peaks, and each peak's phase rotation.
+    sample* mag2;
+    size_t* peaks;
+    FFTW(complex)* rotations;
+
+    // Overlap-add of the synthesized frames, and of their squared windows where they saw real input. After each
+    // window the first synthesis_hop samples are finished. The sums are kept from going below norm_floor, so
+    // the gain stays bounded where the windows barely reach.
+    sample* ola;
+    sample* ola_norm;
+    sample norm_floor;
+
+    size_t windows;
+    size_t frames_in;
+    size_t frames_out;
+
+    // Cubic resampler state: the last four vocoder samples, the next output's position among them, and how
+    // many samples have gone in and out.
+    sample hist[4];
+    double resample_pos;
+    size_t resample_in;
+    size_t resample_out;
+};
+
+PhaseVocoder* vocoder_create(const FFTKernel* fk, double stretch, double semitones) {
+    const size_t window_size = fk->window_size;
+    const size_t spec_size = window_size / 2 + 1;
+    const double pitch = pow(2.0, semitones / 12.0);
+    const double hop = round(fk->hop_size * stretch * pitch);
+    if (!(stretch > 0) || !(hop >= 1) || hop > window_size / 2 || fk->hop_size > window_size) {
+        fprintf(stderr, "Can't stretch by %g and shift by %g semitones with a window of %zu and a hop of %zu.\n",
+                stretch, semitones, window_size, fk->hop_size);
+        return NULL;
+    }
+
+    PhaseVocoder* pv = calloc(1, sizeof(PhaseVocoder));
+    assert(pv);
+    pv->fk = fk;
+    pv->synthesis_hop = (size_t)hop;
+    pv->pitch = pitch;
+
+    pv->time_buf = FFTW(alloc_real)(window_size);
+    pv->freq_buf = FFTW(alloc_complex)(spec_size);
+    pv->prev_in = FFTW(alloc_complex)(spec_size);
+    pv->prev_out = FFTW(alloc_complex)(spec_size);
+    pv->rotations = FFTW(alloc_complex)(spec_size);
+    pv->input = calloc(window_size, sizeof(sample));
+    pv->mag2 = calloc(spec_size, sizeof(sample));
+    pv->peaks = calloc(spec_size, sizeof(size_t));
+    pv->ola = calloc(window_size, sizeof(sample));
+    pv->ola_norm = calloc(window_size, sizeof(sample));
+    assert(pv->time_buf && pv->freq_buf && pv->prev_in && pv->prev_out && pv->rotations);
+    assert(pv->input && pv->mag2 && pv->peaks && pv->ola && pv->ola_norm);
+
+    // Frame k is centred on input k * hop_size + window_size / 2 and output k * synthesis_hop + window_size / 2,
+    // counting the zeros in front. Drop the output up to where the first real input sample lands.
+    const double lead = (double)(window_size - fk->hop_size);
+    pv->input_fill = window_size - fk->hop_size;
+    pv->input_end = SIZE_MAX;
+    pv->lead_in = (size_t)llround((lead - window_size / 2.0) * hop / fk->hop_size + window_size / 2.0);
+
+    // A thousandth of the most the squared windows ever add up to where every frame saw real input.
+    sample largest = 0;
+    for (size_t j = 0; j < pv->synthesis_hop; j++) {
+        sample sum = 0;
+        for (size_t i = j; i < window_size; i += pv->synthesis_hop)
+            sum += fk->window_function[i] * fk->window_function[i];
+        if (sum > largest)
+            largest = sum;
+    }
+    pv->norm_floor = largest * 1e-3;
+
+    return pv;
+}
+
+void vocoder_destroy(PhaseVocoder* pv) {
+    FFTW(free)(pv->time_buf);
+    FFTW(free)(pv->freq_buf);
+    FFTW(free)(pv->prev_in);
+    FFTW(free)(pv->prev_out);
+    FFTW(free)(pv->rotations);
+    free(pv->input);
+    free(pv->mag2);
+    free(pv->peaks);
+    free(pv->ola);
+    free(pv->ola_norm);
+    free(pv);
+}
+
+size_t vocoder_max_output(const PhaseVocoder* pv, size_t frames) {
+    const size_t windows = (frames + pv->fk->window_size) / pv->fk->hop_size + 2;
+    return (size_t)ceil((double)(windows * pv->synthesis_hop + pv->fk->window_size) / pv->pitch) + 4;
+}
+
+// Finds the peaks of mag2: bins louder than the two on either side. Returns how many there are.
+static size_t vocoder_find_peaks(PhaseVocoder* pv, size_t spec_size) {
+    const sample* m = pv->mag2;
+    size_t count = 0;
+    for (size_t k = 0; k < spec_size; k++) {
+        if (m[k] > 0 && (k < 1 || m[k] > m[k - 1]) && (k < 2 || m[k] > m[k - 2])
+            && (k + 1 >= spec_size || m[k] >= m[k + 1]) && (k + 2 >= spec_size || m[k] >= m[k + 2]))
+            pv->peaks[count++] = k;
+    }
+    return count;
+}
+
+// Analyzes the window in `input`, changes its phases and adds it into the overlap-add. Returns the finished
+// samples, synthesis_hop of them, which stay valid until the next call.
+static const sample* vocoder_window(PhaseVocoder* pv) {
+    const FFTKernel* fk = pv->fk;
+    const size_t window_size = fk->window_size;
+    const size_t spec_size = window_size / 2 + 1;
+    const double analysis_hop = fk->hop_size;
+    const double synthesis_hop = pv->synthesis_hop;
+    FFTW(complex)* bins = pv->freq_buf;
+
+    fk->window_kernel(pv->time_buf, pv->input, 1, fk->scaled_window, window_size);
+    FFTW(execute_dft_r2c)(fk->forward, pv->time_buf, bins);
+
+    for (size_t k = 0; k < spec_size; k++)
+        pv->mag2[k] = bins[k][0] * bins[k][0] + bins[k][1] * bins[k][1];
+    const size_t peaks = vocoder_find_peaks(pv, spec_size);
+
+    // The first window keeps its phases. After that, each peak's phase advances by its measured frequency
+    // times the synthesis hop, and its region is rotated by however much that changed the peak.
+    for (size_t i = 0; i < peaks; i++) {
+        const size_t k = pv->peaks[i];
+        double theta = 0;
+        if (pv->windows > 0) {
+            const double omega = 2 * M_PI * k / window_size;
+            const double phi = atan2(bins[k][1], bins[k][0]);
+            const double phi_prev = atan2(pv->prev_in[k][1], pv->prev_in[k][0]);
+            const double psi_prev = atan2(pv->prev_out[k][1], pv->prev_out[k][0]);
+
+            double deviation = phi - phi_prev - omega * analysis_hop;
+            deviation -= 2 * M_PI * round(deviation / (2 * M_PI));
+            const double psi = psi_prev + (omega + deviation / analysis_hop) * synthesis_hop;
+            theta = psi - phi;
+        }
+        pv->rotations[i][0] = cos(theta);
+        pv->rotations[i][1] = sin(theta);
+    }
+    memcpy(pv->prev_in, bins, spec_size * sizeof(FFTW(complex)));
+
+    // Each peak's region runs halfway to the next peak.
+    for (size_t i = 0; i < peaks; i++) {
+        const size_t first = i == 0 ? 0 : (pv->peaks[i - 1] + pv->peaks[i]) / 2 + 1;
+        const size_t last = i + 1 == peaks ? spec_size : (pv->peaks[i] + pv->peaks[i + 1]) / 2 + 1;
+        const sample rr = pv->rotations[i][0], ri = pv->rotations[i][1];
+        for (size_t k = first; k < last; k++) {
+            const sample re = bins[k][0], im = bins[k][1];
+            bins[k][0] = re * rr - im * ri;
+            bins[k][1] = re * ri + im * rr;
+        }
+    }
+    memcpy(pv->prev_out, bins, spec_size * sizeof(FFTW(complex)));
+
+    // c2r gives back the windowed frame, since the analysis window already divided by window_size.
+    // Window it again for synthesis, and overlap-add.
+    FFTW(execute_dft_c2r)(fk->reverse, bins, pv->time_buf);
+    for (size_t i = 0; i < window_size; i++)
+        pv->ola[i] += pv->time_buf[i] * fk->window_function[i];
+
+    // The part of this frame that saw real input rather than the zeros on either side of it.
+    const size_t start = pv->windows * fk->hop_size;
+    const size_t lead = window_size - fk->hop_size;
+    const size_t real_first = MIN(lead - MIN(lead, start), window_size);
+    const size_t real_last = pv->input_end > start ? MIN(pv->input_end - start, window_size) : 0;
+    for (size_t i = real_first; i < real_last; i++)
+        pv->ola_norm[i] += fk->window_function[i] * fk->window_function[i];
+
+    for (size_t j = 0; j < pv->synthesis_hop; j++)
+        pv->time_buf[j] = pv->ola[j] / MAX(pv->ola_norm[j], pv->norm_floor);
+    memmove(pv->ola, pv->ola + pv->synthesis_hop, (window_size - pv->synthesis_hop) * sizeof(sample));
+    memset(pv->ola + window_size - pv->synthesis_hop, 0, pv->synthesis_hop * sizeof(sample));
+    memmove(pv->ola_norm, pv->ola_norm + pv->synthesis_hop, (window_size - pv->synthesis_hop) * sizeof(sample));
+    memset(pv->ola_norm + window_size - pv->synthesis_hop, 0, pv->synthesis_hop * sizeof(sample));
+
+    pv->windows++;
+    return pv->time_buf;
+}
+
+// Catmull-Rom between p1 and p2.
+static inline sample cubic_interpolate(const sample* p, sample f) {
+    return p[1] + 0.5f * f * (p[2] - p[0] + f * (2 * p[0] - 5 * p[1] + 4 * p[2] - p[3] + f * (3 * (p[1] - p[2]) + p[3] - p[0])));
+}
+
+// Passes `n` vocoder samples on to `out`, resampling them if there is a pitch shift. Returns how many were written.
+static size_t vocoder_emit(PhaseVocoder* pv, const sample* x, size_t n, sample* out) {
+    const size_t drop = MIN(pv->lead_in, n);
+    pv->lead_in -= drop;
+    x += drop;
+    n -= drop;
+
+    pv->frames_out += n;
+    if (pv->pitch == 1) {
+        memcpy(out, x, n * sizeof(sample));
+        return n;
+    }
+
+    // hist holds vocoder samples resample_in - 4 to resample_in - 1, and interpolates between the middle two.
+    size_t written = 0;
+    for (size_t i = 0; i < n; i++) {
+        memmove(pv->hist, pv->hist + 1, 3 * sizeof(sample));
+        pv->hist[3] = x[i];
+        pv->resample_in++;
+
+        const double base = (double)pv->resample_in - 3;
+        while (pv->resample_pos <= base + 1) {
+            out[written++] = cubic_interpolate(pv->hist, pv->resample_pos - base);
+            pv->resample_pos += pv->pitch;
+        }
+    }
+    pv->resample_out += written;
+    return written;
+}
+
+size_t vocoder_process(PhaseVocoder* pv, const sample* in, size_t stride, size_t frames, sample* out) {
+    const size_t window_size = pv->fk->window_size;
+    const size_t hop = pv->fk->hop_size;
+    size_t written = 0;
+
+    for (size_t i = 0; i < frames;) {
+        const size_t take = MIN(frames - i, window_size - pv->input_fill);
+        for (size_t j = 0; j < take; j++)
+            pv->input[pv->input_fill + j] = in[(i + j) * stride];
+        pv->input_fill += take;
+        pv->frames_in += take;
+        i += take;
+
+        if (pv->input_fill == window_size) {
+            written += vocoder_emit(pv, vocoder_window(pv), pv->synthesis_hop, out + written);
+            memmove(pv->input, pv->input + hop, (window_size - hop) * sizeof(sample));
+            pv->input_fill = window_size - hop;
+        }
+    }
+    return written;
+}
+
+size_t vocoder_finish(PhaseVocoder* pv, sample* out) {
+    const size_t window_size = pv->fk->window_size;
+    const size_t hop = pv->fk->hop_size;
+    const size_t stretched = (size_t)llround((double)pv->frames_in * pv->synthesis_hop / hop);
+    size_t written = 0;
+
+    // Every window processed so far ended inside the input, so none of them has gone past `stretched` yet.
+    // Keep going on zeros until the output reaches it; the samples a window finishes have every frame that
+    // overlaps them in already, including the ones that only partly cover the input.
+    pv->input_end = window_size - hop + pv->frames_in;
+    while (pv->frames_out < stretched) {
+        memset(pv->input + pv->input_fill, 0, (window_size - pv->input_fill) * sizeof(sample));
+        const sample* done = vocoder_window(pv);
+        const size_t keep = stretched - pv->frames_out + MIN(pv->lead_in, pv->synthesis_hop);
+        written += vocoder_emit(pv, done, MIN(pv->synthesis_hop, keep), out + written);
+
+        if (pv->input_fill > hop) {
+            memmove(pv->input, pv->input + hop, (window_size - hop) * sizeof(sample));
+            pv->input_fill -= hop;
+        } else {
+            pv->input_fill = 0;
+        }
+    }
+    memset(pv->ola, 0, window_size * sizeof(sample));
+    memset(pv->ola_norm, 0, window_size * sizeof(sample));
+
+    // The resampler runs a sample behind, so push silence through until it has caught up, and drop any extra.
+    if (pv->pitch != 1) {
+        const size_t total = (size_t)llround(stretched / pv->pitch);
+        const sample zero = 0;
+        for (int i = 0; i < 4 && pv->resample_out < total; i++) {
+            written += vocoder_emit(pv, &zero, 1, out + written);
+        }
+        if (pv->resample_out > total) {
+            written -= pv->resample_out - total;
+            pv->resample_out = total;
+        }
+    }
+    return written;
+}
+
+typedef struct {
+    PhaseVocoder* pv;
+    const Audiodata* in;
+    Audiodata* out;
+} StretchJob;
+
+// The block size the channels are streamed through their vocoders in.
+#define VOCODER_BLOCK 16384
+
+static void stretch_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    TRACE_SCOPE("vocoder");
+    const StretchJob* job = (const StretchJob*)ctx + task;
+    const Audiodata* in = job->in;
+    sample* out = job->out->data;
+
+    size_t written = 0;
+    for (size_t start = 0; start < in->frames; start += VOCODER_BLOCK) {
+        const size_t frames = MIN(VOCODER_BLOCK, in->frames - start);
+        written += vocoder_process(job->pv, in->data + start * in->channels + task, in->channels, frames, out + written);
+    }
+    written += vocoder_finish(job->pv, out + written);
+    job->out->frames = written;
+}
+
+Audiodata* vocoder_stretch(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad, double stretch, double semitones) {
+    StretchJob* jobs = calloc(ad->channels, sizeof(StretchJob));
+    assert(jobs);
+    AudiodataMany am = { .count = ad->channels, .data = calloc(ad->channels, sizeof(Audiodata)) };
+    assert(am.data);
+
+    bool ok = true;
+    for (int c = 0; c < ad->channels; c++) {
+        jobs[c].pv = vocoder_create(fk, stretch, semitones);
+        if (!jobs[c].pv) {
+            ok = false;
+            break;
+        }
+        am.data[c] = (Audiodata){ .sample_rate = ad->sample_rate, .channels = 1 };
+        am.data[c].data = pool_alloc(vocoder_max_output(jobs[c].pv, ad->frames) * sizeof(sample));
+        jobs[c].in = ad;
+        jobs[c].out = &am.data[c];
+    }
+
+    Audiodata* ret = NULL;
+    if (ok) {
+        threadpool_run(pool, stretch_task, jobs, ad->channels);
+        ret = audiodata_join_channels(&am);
+    }
+
+    for (int c = 0; c < ad->channels; c++) {
+        if (jobs[c].pv)
+            vocoder_destroy(jobs[c].pv);
+        pool_free(am.data[c].data);
+    }
+    free(am.data);
+    free(jobs);
+    return ret;
+}
+
+// Phase reconstruction.
+// Magnitude-only spectrograms, like the ones an image gives, are turned back into something that resynthesizes
+// cleanly with fast Griffin-Lim (Perraudin, Balazs and Sondergaard 2013): alternate between the spectrogram
+// of the current resynthesis and the target magnitudes, with momentum on the phases. Everything the iterations
+// touch is allocated up front, and every step is split across the pool by windows.
+const PhaseOptions phase_defaults = {
+    .max_iterations = 50,
+    .momentum = 0.99,
+    .tolerance = 0,
+    .random_phase = true,
+};
+
+typedef struct {
+    const FFTKernel* fk;
+    Spectrodata* sd;
+    const sample* target;
+    const FFTW(complex)* consistent;
+    const FFTW(complex)* previous;
+    double momentum;
+    size_t task_count;
+
+    // The resynthesis, and 1 / the sum of the windows overlapping each of its samples. Plain overlap-add only
+    // gives back the input when the windows sum to 1, which Hann at a quarter window doesn't, and nothing
+    // does over the first and last window, where fewer frames overlap.
+    Audiodata* ad;
+    const sample* inverse_gain;
+
+    // One partial sum of squared magnitude error per task, so the total doesn't depend on timing.
+    double* error;
+} PhaseJob;
+
+static void phase_job_range(const PhaseJob* job, size_t task, size_t* first, size_t* last) {
+    const size_t spec_size = job->fk->window_size / 2 + 1;
+    *first = job->sd->window_count * task / job->task_count * spec_size;
+    *last = job->sd->window_count * (task + 1) / job->task_count * spec_size;
+}
+
+// Gives every bin of `sd` its target magnitude and a random phase. The phases depend only on the bin.
+static void phase_init_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    const PhaseJob* job = ctx;
+    size_t first, last;
+    phase_job_range(job, task, &first, &last);
+
+    for (size_t i = first; i < last; i++) {
+        uint32_t h = (uint32_t)i * 2654435761u;
+        h ^= h >> 15;
+        h *= 2246822519u;
+        h ^= h >> 13;
+        const double phase = h * (2 * M_PI / 4294967296.0);
+        job->sd->data[i][0] = job->target[i] * cos(phase);
+        job->sd->data[i][1] = job->target[i] * sin(phase);
+    }
+}
+
+static void phase_normalize_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    const PhaseJob* job = ctx;
+    const size_t first = job->ad->frames * task / job->task_count;
+    const size_t last = job->ad->frames * (task + 1) / job->task_count;
+    for (size_t i = first; i < last; i++)
+        job->ad->data[i] *= job->inverse_gain[i];
+}
+
+// Measures how far `consistent` is from the target, then steps past it by the momentum and puts the target
+// magnitudes back on the result, in `sd`.
+static void phase_update_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    TRACE_SCOPE("phase_update");
+    const PhaseJob* job = ctx;
+    const sample momentum = job->momentum;
+    size_t first, last;
+    phase_job_range(job, task, &first, &last);
+
+    double error = 0;
+    for (size_t i = first; i < last; i++) {
+        const sample cr = job->consistent[i][0], ci = job->consistent[i][1];
+        const sample diff = sqrt(cr * cr + ci * ci) - job->target[i];
+        error += diff * diff;
+
+        const sample tr = cr + momentum * (cr - job->previous[i][0]);
+        const sample ti = ci + momentum * (ci - job->previous[i][1]);
+        const sample mag = sqrt(tr * tr + ti * ti);
+        if (mag > 0) {
+            job->sd->data[i][0] = tr * (job->target[i] / mag);
+            job->sd->data[i][1] = ti * (job->target[i] / mag);
+        } else {
+            job->sd->data[i][0] = job->target[i];
+            job->sd->data[i][1] = 0;
+        }
+    }
+    job->error[task] = error;
+}
+
+size_t fftkernel_reconstruct_phase(const FFTKernel* fk, ThreadPool* pool, Spectrodata* sd, const PhaseOptions* opt, double* convergence) {
+    assert(fk->worker_count >= pool->thread_count);
+    assert(sd->layout == SPECTRO_INTERLEAVED);
+    if (!opt)
+        opt = &phase_defaults;
+
+    const size_t bins = sd->window_count * (fk->window_size / 2 + 1);
+    sample* target = pool_alloc(bins * sizeof(sample));
+    double target_norm = 0;
+    for (size_t i = 0; i < bins; i++) {
+        target[i] = sqrt(sd->data[i][0] * sd->data[i][0] + sd->data[i][1] * sd->data[i][1]);
+        target_norm += (double)target[i] * target[i];
+    }
+    target_norm = sqrt(target_norm);
+
+    // The resynthesis, and the spectrograms of this iteration's and the last one's.
+    Audiodata ad = { 0 };
+    audiodata_init_for(&ad, sd);
+    Spectrodata consistent = { 0 }, previous = { 0 };
+    spectrodata_init(&consistent, fk, sd->sample_rate, sd->original_length);
+    spectrodata_init(&previous, fk, sd->sample_rate, sd->original_length);
+    assert(consistent.window_count == sd->window_count);
+
+    ReverseJob reverse;
+    reverse_job_init(&reverse, fk, sd, &ad, pool->thread_count);
+    ForwardJob forward = {
+        .fk = fk,
+        .src = channel_view(&ad, 0),
+        .sd = &consistent,
+        .task_count = MIN(pool->thread_count * 4, sd->window_count),
+    };
+    // The window sum at every sample, adding each frame where fftkernel_reverse_range puts it.
+    sample* inverse_gain = pool_calloc(ad.frames, sizeof(sample));
+    assert(inverse_gain);
+    for (size_t w = 0; w < sd->window_count && w * fk->hop_size < ad.frames; w++) {
+        const size_t start = w * fk->hop_size;
+        const size_t end = MIN(start + fk->window_size, ad.frames);
+        for (size_t i = start; i < end; i++)
+            inverse_gain[i] += fk->window_function[i - start];
+    }
+    for (size_t i = 0; i < ad.frames; i++)
+        inverse_gain[i] = inverse_gain[i] > 1e-3 ? 1 / inverse_gain[i] : 1e3;
+
+    PhaseJob update = {
+        .fk = fk,
+        .sd = sd,
+        .target = target,
+        .task_count = forward.task_count,
+        .ad = &ad,
+        .inverse_gain = inverse_gain,
+        .error = calloc(forward.task_count > 0 ? forward.task_count : 1, sizeof(double)),
+    };
+    assert(update.error);
+
+    if (opt->random_phase && update.task_count > 0)
+        threadpool_run(pool, phase_init_task, &update, update.task_count);
+
+    size_t iterations = 0;
+    double sc = 0;
+    while (iterations < opt->max_iterations && update.task_count > 0) {
+        memset(ad.data, 0, ad.frames * sizeof(sample));
+        threadpool_run(pool, reverse_task, &reverse, reverse.task_count);
+        threadpool_run(pool, reverse_seam_task, &reverse, reverse.task_count);
+        threadpool_run(pool, phase_normalize_task, &update, update.task_count);
+        threadpool_run(pool, forward_task, &forward, forward.task_count);
+
+        // There is nothing to step past on the first iteration.
+        update.consistent = consistent.data;
+        update.previous = iterations == 0 ? consistent.data : previous.data;
+        update.momentum = iterations == 0 ? 0 : opt->momentum;
+        threadpool_run(pool, phase_update_task, &update, update.task_count);
+        iterations++;
+
+        double error = 0;
+        for (size_t t = 0; t < update.task_count; t++)
+            error += update.error[t];
+        sc = target_norm > 0 ? sqrt(error) / target_norm : 0;
+
+        FFTW(complex)* swap = previous.data;
+        previous.data = consistent.data;
+        consistent.data = swap;
+
+        if (sc < opt->tolerance)
+            break;
+    }
+
+    if (convergence)
+        *convergence = sc;
+    spectrodata_mark_dirty(sd, 0, sd->window_count);
+
+    free(update.error);
+    pool_free(inverse_gain);
+    FFTW(free)(reverse.seams);
+    spectrodata_free_bins(&consistent);
+    spectrodata_free_bins(&previous);
+    pool_free(ad.data);
+    pool_free(target);
+    return iterations;
+}
+
+void spectrodata_destroy(Spectrodata *sd) {
+    spectrodata_free_bins(sd);
+    spectrodata_clear_dirty(sd);
+    free(sd);
+}
+
+static void file_unmap(void* base, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+void spectrodata_many_destroy(SpectrodataMany *sm) {
+    if (sm->mapping) {
+        file_unmap(sm->mapping, sm->mapping_size);
+    } else {
+        for (int i = 0; i < sm->count; i++)
+            spectrodata_free_bins(&sm->data[i]);
+    }
+    for (int i = 0; i < sm->count; i++)
+        spectrodata_clear_dirty(&sm->data[i]);
+    free(sm->data);
+    free(sm);
+}
+
+// The spectrogram file format.
+// A 64-byte header, then the bins of every channel, one channel after another, each exactly as they are laid
+// out in Spectrodata.data. The bins start on a 64-byte boundary, so a mapped file can be used in place.
+// Everything is in native byte order; these are working files, not an interchange format.
+// The magic also says which precision the bins are in, since a build only reads its own.
+#define SPECTRO_MAGIC_FLOAT 0x50534546u // "FESP"
+#define SPECTRO_MAGIC_DOUBLE 0x44534546u // "FESD"
+#define SPECTRO_MAGIC_LONG_DOUBLE 0x4C534546u // "FESL"
+#if defined(FOURIEDIT_LONG_DOUBLE)
+#define SPECTRO_FILE_MAGIC SPECTRO_MAGIC_LONG_DOUBLE
+#elif defined(FOURIEDIT_DOUBLE)
+#define SPECTRO_FILE_MAGIC SPECTRO_MAGIC_DOUBLE
+#else
+#define SPECTRO_FILE_MAGIC SPECTRO_MAGIC_FLOAT
+#endif
+#define SPECTRO_FILE_VERSION 1
+
+_Static_assert(sizeof(SpectroFileHeader) == 64, "SpectroFileHeader must stay 64 bytes");
+
+static SpectroFileHeader spectro_file_header(const FFTKernel* fk, int channels, size_t sample_rate, size_t original_length, size_t window_count) {
+    return (SpectroFileHeader){
+        .magic = SPECTRO_FILE_MAGIC,
+        .version = SPECTRO_FILE_VERSION,
+        .window_type = fk->window_type,
+        .channels = channels,
+        .sample_rate = sample_rate,
+        .original_length = original_length,
+        .window_count = window_count,
+        .window_size = fk->window_size,
+        .hop_size = fk->hop_size,
+        .data_offset = sizeof(SpectroFileHeader),
+    };
+}
+
+bool spectrodata_write_file(const char* fname, const FFTKernel* fk, const SpectrodataMany* sm) {
+    TRACE_SCOPE("write_spectro");
+    FILE* f = fopen(fname, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to open spectrogram file for writing '%s'.\n", fname);
+        return false;
+    }
+
+    const SpectroFileHeader header = spectro_file_header(fk, sm->count, sm->data[0].sample_rate,
+                                                         sm->data[0].original_length, sm->data[0].window_count);
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    const size_t bins = sm->data[0].window_count * (fk->window_size / 2 + 1);
+    for (int c = 0; ok && c < sm->count; c++) {
+        assert(sm->data[c].window_count == header.window_count);
+        assert(sm->data[c].layout == SPECTRO_INTERLEAVED);
+        ok = fwrite(sm->data[c].data, sizeof(FFTW(complex)), bins, f) == bins;
+    }
+
+    if (fclose(f) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Couldn't write all of spectrogram file '%s'.\n", fname);
+    return ok;
+}
+
+// Writes a spectrogram file as its windows come in, in any order, so it never has to be in memory all at once.
+// The size of the file has to be known up front, since each channel's windows go in one run.
+struct SpectroFileWriter {
+    FILE* file;
+    const char* fname;
+    size_t window_count;
+    size_t spec_size;
+    bool failed;
+};
+
+// 64-bit fseek, which MinGW spells differently.
+static int file_seek(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (long long)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+SpectroFileWriter* spectro_file_writer_open(const char* fname, const FFTKernel* fk, int channels, size_t sample_rate, size_t frames) {
+    FILE* f = fopen(fname, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to open spectrogram file for writing '%s'.\n", fname);
+        return NULL;
+    }
+
+    SpectroFileWriter* w = calloc(1, sizeof(SpectroFileWriter));
+    assert(w);
+    w->file = f;
+    w->fname = fname;
+    w->window_count = (frames + fk->window_size - 1) / fk->hop_size;
+    w->spec_size = fk->window_size / 2 + 1;
+
+    const SpectroFileHeader header = spectro_file_header(fk, channels, sample_rate, frames, w->window_count);
+    w->failed = fwrite(&header, sizeof(header), 1, f) != 1;
+    return w;
+}
+
+void spectro_file_write_windows(void* ctx, int channel, size_t first, size_t count, const FFTW(complex)* bins) {
+    TRACE_SCOPE("write_spectro");
+    SpectroFileWriter* w = ctx;
+    if (w->failed)
+        return;
+
+    const uint64_t offset = sizeof(SpectroFileHeader)
+        + ((uint64_t)channel * w->window_count + first) * w->spec_size * sizeof(FFTW(complex));
+    const size_t n = count * w->spec_size;
+    w->failed = file_seek(w->file, offset) != 0 || fwrite(bins, sizeof(FFTW(complex)), n, w->file) != n;
+}
+
+bool spectro_file_writer_close(SpectroFileWriter* w) {
+    bool ok = !w->failed;
+    if (fclose(w->file) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Couldn't write all of spectrogram file '%s'.\n", w->fname);
+    free(w);
+    return ok;
+}
+
+// Maps the whole file and returns its base, or NULL.
+static void* file_map(const char* fname, bool writable, size_t* size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fname, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER len;
+    HANDLE mapping = NULL;
+    void* base = NULL;
+    if (GetFileSizeEx(file, &len) && len.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+        base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+
+    // The view keeps the mapping alive on its own.
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+
+    *size = base ? (size_t)len.QuadPart : 0;
+    return base;
+#else
+    int fd = open(fname, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void* base = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        base = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            base = NULL;
+    }
+    close(fd);
+
+    *size = base ? (size_t)st.st_size : 0;
+    return base;
+#endif
+}
+
+SpectrodataMany* spectrodata_map_file(const char* fname, bool writable, SpectroFileHeader* header) {
+    size_t size;
+    void* base = file_map(fname, writable, &size);
+    if (!base) {
+        fprintf(stderr, "Error opening spectrogram file '%s'.\n", fname);
+        return NULL;
+    }
+
+    const SpectroFileHeader* h = base;
+    if (size >= sizeof(SpectroFileHeader) && h->magic != SPECTRO_FILE_MAGIC
+        && (h->magic == SPECTRO_MAGIC_FLOAT || h->magic == SPECTRO_MAGIC_DOUBLE || h->magic == SPECTRO_MAGIC_LONG_DOUBLE)) {
+        fprintf(stderr, "'%s' was written by a %s build; this is a %s build.\n", fname,
+                h->magic == SPECTRO_MAGIC_FLOAT ? "float" : h->magic == SPECTRO_MAGIC_DOUBLE ? "double" : "long double",
+                SAMPLE_NAME);
+        file_unmap(base, size);
+        return NULL;
+    }
+
+    bool ok = size >= sizeof(SpectroFileHeader) && h->magic == SPECTRO_FILE_MAGIC && h->version == SPECTRO_FILE_VERSION
+        && h->window_type <= WF_NONE && h->channels > 0 && h->window_size >= 2 && h->hop_size > 0
+        && h->data_offset % 64 == 0 && h->data_offset <= size;
+
+    // Written as divisions so a corrupt header can't overflow its way past the check.
+    ok = ok && h->window_count <= (size - h->data_offset) / sizeof(FFTW(complex)) / h->channels / (h->window_size / 2 + 1);
+    if (!ok) {
+        fprintf(stderr, "'%s' is not a spectrogram file, or it is truncated.\n", fname);
+        file_unmap(base, size);
+        return NULL;
+    }
+
+    SpectrodataMany* sm = calloc(1, sizeof(SpectrodataMany));
+    assert(sm);
+    sm->count = h->channels;
+    sm->data = calloc(h->channels, sizeof(Spectrodata));
+    assert(sm->data);
+    sm->mapping = base;
+    sm->mapping_size = size;
+
+    const size_t channel_bins = h->window_count * (h->window_size / 2 + 1);
+    FFTW(complex)* bins = (FFTW(complex)*)((char*)base + h->data_offset);
+    for (int c = 0; c < sm->count; c++) {
+        sm->data[c] = (Spectrodata){
+            .sample_rate = h->sample_rate,
+            .original_length = h->original_length,
+            .window_count = h->window_count,
+            .data = bins + c * channel_bins,
+        };
+    }
+
+    *header = *h;
+    return sm;
+}
+
+// Pipelined analysis.
+// Converting a file one step after another makes the disk, the codec and the transforms take turns. Here a
+// decoder thread reads blocks of windows with libsndfile, the calling thread transforms each block across the
+// pool, and a writer thread puts finished blocks straight into their place in the spectrogram file, all at once.
+// A fixed set of blocks goes round between them through bounded queues: a stage that gets ahead finds the free
+// queue empty and waits, so memory stays at PIPELINE_BLOCKS blocks however long the file is, and the wall time
+// comes out near that of the slowest stage.
+#define PIPELINE_BLOCKS 4
+
+// Roughly how many frames of audio a block covers.
+#define PIPELINE_BLOCK_FRAMES 65536
+
+typedef struct {
+    void** items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} BoundedQueue;
+
+static void bounded_queue_init(BoundedQueue* q, size_t capacity) {
+    *q = (BoundedQueue){ .capacity = capacity };
+    q->items = calloc(capacity, sizeof(void*));
+    assert(q->items);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void bounded_queue_destroy(BoundedQueue* q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->items);
+}
+
+// Waits while the queue is full.
+static void bounded_queue_push(BoundedQueue* q, void* item) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->count++) % q->capacity] = item;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Waits while the queue is empty. Returns NULL once it is empty and closed.
+static void* bounded_queue_pop(BoundedQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    void* item = NULL;
+    if (q->count > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+// Nothing more will be pushed; wakes everyone waiting on an empty queue.
+static void bounded_queue_close(BoundedQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Windows [first_window, first_window + window_count) of every channel.
+typedef struct {
+    size_t first_window;
+    size_t window_count;
+
+    // Interleaved frames starting at first_window * hop_size. Only the decoder writes here, so the frames a
+    // block shares with the one before it can be copied over even while the other block is still in flight.
+    sample* audio;
+    size_t frames;
+
+    // One run of window_count * spec_size bins per channel, in the order they go in the file.
+    FFTW(complex)* bins;
+} PipelineBlock;
+
+typedef struct {
+    const FFTKernel* fk;
+    SNDFILE* sndfile;
+    SF_INFO info;
+    SpectroFileWriter* out;
+    size_t window_count;
+    size_t block_windows;
+
+    BoundedQueue free;
+    BoundedQueue decoded;
+    BoundedQueue computed;
+
+    double decode_seconds;
+    double write_seconds;
+} Pipeline;
+
+static void* pipeline_decode_main(void* arg) {
+    Pipeline* p = arg;
+    const FFTKernel* fk = p->fk;
+    const int channels = p->info.channels;
+    const size_t frames = p->info.frames;
+    size_t frames_read = 0;
+    const PipelineBlock* prev = NULL;
+    size_t prev_start = 0;
+
+    for (size_t w = 0; w < p->window_count; w += p->block_windows) {
+        PipelineBlock* b = bounded_queue_pop(&p->free);
+        const double t0 = now_seconds();
+        TRACE_SCOPE("read_audio");
+
+        b->first_window = w;
+        b->window_count = MIN(p->block_windows, p->window_count - w);
+        const size_t start = MIN(w * fk->hop_size, frames);
+        const size_t end = MIN(start + (b->window_count - 1) * fk->hop_size + fk->window_size, frames);
+        b->frames = end - start;
+
+        // Keep what the last block already read, skip any gap a hop longer than the window leaves, and read the rest.
+        size_t have = 0;
+        if (prev && frames_read > start) {
+            have = frames_read - start;
+            memmove(b->audio, prev->audio + (start - prev_start) * channels, have * channels * sizeof(sample));
+        }
+        while (frames_read < start) {
+            const size_t skip = MIN(start - frames_read, b->frames > 0 ? b->frames : 1);
+            sf_readf_sample(p->sndfile, b->audio, skip, channels);
+            frames_read += skip;
+        }
+
+        // A file that comes up short reads as silence, the same as it does in audiodata_read_file.
+        const size_t want = b->frames - have;
+        sf_count_t got = want > 0 ? sf_readf_sample(p->sndfile, b->audio + have * channels, want, channels) : 0;
+        if (got < 0)
+            got = 0;
+        memset(b->audio + (have + got) * channels, 0, (want - got) * channels * sizeof(sample));
+        frames_read = MAX(frames_read, end);
+
+        prev = b;
+        prev_start = start;
+        p->decode_seconds += now_seconds() - t0;
+        bounded_queue_push(&p->decoded, b);
+    }
+
+    bounded_queue_close(&p->decoded);
+    return NULL;
+}
+
+static void* pipeline_write_main(void* arg) {
+    Pipeline* p = arg;
+    const size_t spec_size = p->fk->window_size / 2 + 1;
+    const int channels = p->info.channels;
+
+    PipelineBlock* b;
+    while ((b = bounded_queue_pop(&p->computed))) {
+        const double t0 = now_seconds();
+        TRACE_SCOPE("write_spectro");
+
+        // After a failure the writer does nothing, but the blocks still go round, so the other stages never wait
+        // on a writer that quit.
+        for (int c = 0; c < channels; c++)
+            spectro_file_write_windows(p->out, c, b->first_window, b->window_count, b->bins + c * p->block_windows * spec_size);
+
+        p->write_seconds += now_seconds() - t0;
+        bounded_queue_push(&p->free, b);
+    }
+    return NULL;
+}
+
+bool fftkernel_forward_file(const FFTKernel* fk, ThreadPool* pool, const char* input, const char* output, PipelineStats* stats) {
+    assert(fk->worker_count >= pool->thread_count);
+    const double start_time = now_seconds();
+
+    Pipeline p = { .fk = fk };
+    p.sndfile = sf_open(input, SFM_READ, &p.info);
+    if (!p.sndfile) {
+        fprintf(stderr, "Error opening audio file '%s': %s\n", input, sf_strerror(NULL));
+        return false;
+    }
+    p.out = spectro_file_writer_open(output, fk, p.info.channels, p.info.samplerate, p.info.frames);
+    if (!p.out) {
+        sf_close(p.sndfile);
+        return false;
+    }
+
+    const int channels = p.info.channels;
+    const size_t spec_size = fk->window_size / 2 + 1;
+    p.window_count = p.out->window_count;
+
+    // Enough windows per block to give every worker a few, and to make each read worth a syscall.
+    p.block_windows = MAX(PIPELINE_BLOCK_FRAMES / fk->hop_size, pool->thread_count * 4);
+    p.block_windows = MAX(MIN(p.block_windows, p.window_count), 1);
+
+    bounded_queue_init(&p.free, PIPELINE_BLOCKS);
+    bounded_queue_init(&p.decoded, PIPELINE_BLOCKS);
+    bounded_queue_init(&p.computed, PIPELINE_BLOCKS);
+
+    PipelineBlock blocks[PIPELINE_BLOCKS];
+    const size_t block_frames = (p.block_windows - 1) * fk->hop_size + fk->window_size;
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        blocks[i] = (PipelineBlock){
+            .audio = pool_alloc(block_frames * channels * sizeof(sample)),
+            .bins = FFTW(malloc)(channels * p.block_windows * spec_size * sizeof(FFTW(complex))),
+        };
+        assert(blocks[i].bins);
+        bounded_queue_push(&p.free, &blocks[i]);
+    }
+
+    pthread_t decoder, writer;
+    int err = pthread_create(&decoder, NULL, pipeline_decode_main, &p);
+    assert(err == 0);
+    err = pthread_create(&writer, NULL, pipeline_write_main, &p);
+    assert(err == 0);
+    (void)err;
+
+    ForwardJob* jobs = calloc(channels, sizeof(ForwardJob));
+    Spectrodata* sds = calloc(channels, sizeof(Spectrodata));
+    assert(jobs && sds);
+    double compute_seconds = 0;
+
+    PipelineBlock* b;
+    while ((b = bounded_queue_pop(&p.decoded))) {
+        const double t0 = now_seconds();
+
+        // Each channel of the block looks like a short Spectrodata of its own, so the ordinary forward tasks
+        // transform it: window w of the block stages from frame w * hop_size of b->audio.
+        const size_t tasks_per_channel = MIN((pool->thread_count * 4 + channels - 1) / channels, b->window_count);
+        for (int c = 0; c < channels; c++) {
+            sds[c] = (Spectrodata){ .window_count = b->window_count, .data = b->bins + c * p.block_windows * spec_size };
+            jobs[c] = (ForwardJob){
+                .fk = fk,
+                .src = { .data = b->audio + c, .stride = channels, .frames = b->frames },
+                .sd = &sds[c],
+                .task_count = tasks_per_channel,
+            };
+        }
+        many_run(pool, jobs, sizeof(ForwardJob), channels, tasks_per_channel, forward_task);
+
+        compute_seconds += now_seconds() - t0;
+        bounded_queue_push(&p.computed, b);
+    }
+    bounded_queue_close(&p.computed);
+
+    pthread_join(decoder, NULL);
+    pthread_join(writer, NULL);
+
+    free(sds);
+    free(jobs);
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        pool_free(blocks[i].audio);
+        FFTW(free)(blocks[i].bins);
+    }
+    bounded_queue_destroy(&p.free);
+    bounded_queue_destroy(&p.decoded);
+    bounded_queue_destroy(&p.computed);
+    sf_close(p.sndfile);
+    const bool ok = spectro_file_writer_close(p.out);
+
+    if (stats) {
+        *stats = (PipelineStats){
+            .decode = p.decode_seconds,
+            .compute = compute_seconds,
+            .write = p.write_seconds,
+            .wall = now_seconds() - start_time,
+        };
+    }
+    return ok;
 }
-#endif
\ No newline at end of file
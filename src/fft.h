@@ -0,0 +1,470 @@
+#ifndef FOURIEDIT_FFT_H
+#define FOURIEDIT_FFT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "typename.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Seconds on a monotonic clock, for timing.
+double now_seconds(void);
+
+// Copies n samples `stride` apart out of `src` and windows them into `dst`.
+typedef void (*WindowKernel)(sample* dst, const sample* src, size_t stride, const sample* window, size_t n);
+
+enum WindowFunction {
+    WF_HANN,
+    WF_NONE,
+};
+
+// Scratch space for one thread running a kernel. Same alignment as the buffers the plans were made with,
+// so they can be handed to the new-array execute functions.
+typedef struct {
+    sample* time_buf;
+    FFTW(complex)* freq_buf;
+
+    // For the split-complex layout; see fftkernel_enable_split.
+    sample* split_re;
+    sample* split_im;
+} FFTScratch;
+
+typedef struct {
+    enum WindowFunction window_type;
+    sample* window_function;
+
+    // window_function / window_size, so staging is one multiply per sample.
+    sample* scaled_window;
+    WindowKernel window_kernel;
+
+    size_t window_size;
+    size_t hop_size;
+    sample* time_buf;
+    FFTW(complex)* freq_buf;
+
+    FFTW(plan) forward;
+    FFTW(plan) reverse;
+
+    // Split-complex forward transform, into split_re and split_im. Unset until fftkernel_enable_split.
+    sample* split_re;
+    sample* split_im;
+    FFTW(plan) forward_split;
+
+    // Indexed by ThreadPool worker. Only the parallel paths use these; see fftkernel_reserve_workers.
+    size_t worker_count;
+    FFTScratch* workers;
+
+    // The batched engine transforms batch_windows windows per FFTW call. Unset until fftkernel_enable_batch.
+    size_t batch_windows;
+    sample* batch_time;
+    FFTW(complex)* batch_freq;
+    FFTW(plan) forward_batch;
+} FFTKernel;
+
+typedef struct {
+    size_t sample_rate;
+
+    size_t frames;
+    sample* data;
+
+    int channels;
+} Audiodata;
+
+// Remember, this stores them as a contiguous array of Audiodata, not an array of pointers to Audiodata.
+typedef struct {
+    int count;
+    Audiodata* data;
+} AudiodataMany;
+
+enum SpectroLayout {
+    SPECTRO_INTERLEAVED,
+    SPECTRO_SPLIT,
+};
+
+typedef struct {
+    // Justification: in a reversal operation, the default behavior (non-specified) should be to preserve sample rate.
+    size_t sample_rate;
+
+    // Justification: the original length of audio is rounded.
+    size_t original_length;
+
+    size_t window_count;
+
+    // Guaranteed to have a size of sd->window_count * (fk->window_size / 2 + 1).
+    // Yes, it is necessarily associated with the kernel.
+    FFTW(complex)* data;
+
+    // There is no option for interlacing windows. Just seems like unnecessary copying.
+
+    // With SPECTRO_SPLIT, `data` is NULL and the real and imaginary parts are in separate planes, indexed the
+    // same way as `data` would be. Magnitude and masking passes can then use straight vector loads.
+    enum SpectroLayout layout;
+    sample* re;
+    sample* im;
+
+    // One bit per window that has been edited since it was last resynthesized; see spectrodata_mark_dirty.
+    // NULL until something is marked.
+    uint64_t* dirty;
+} Spectrodata;
+
+// One Spectrodata per channel, stored the same way as AudiodataMany.
+typedef struct {
+    int count;
+    Spectrodata* data;
+
+    // Set when the bins live in a mapped file (see spectrodata_map_file) rather than on the heap.
+    void* mapping;
+    size_t mapping_size;
+} SpectrodataMany;
+
+// Thread pool.
+// A fork-join pool. The thread calling threadpool_run takes part as worker 0, so a pool of size 1 has no
+// extra threads at all. Tasks are handed out one at a time, and each one is told which worker runs it,
+// so per-worker scratch can be indexed without locking. threadpool_run is not reentrant.
+typedef void (*PoolTask)(void* ctx, size_t task, size_t worker);
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool* pool;
+    size_t index;
+} PoolWorker;
+
+struct ThreadPool {
+    size_t thread_count;
+    pthread_t* threads;
+    PoolWorker* workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+
+    PoolTask task;
+    void* ctx;
+    size_t task_count;
+    size_t next_task;
+    size_t busy;
+    unsigned long generation;
+    bool quit;
+};
+
+// How many CPUs are online, and at least 1.
+size_t cpu_count(void);
+
+// 0 means one worker per CPU.
+ThreadPool* threadpool_create(size_t thread_count);
+
+// Runs task(ctx, 0..task_count-1, worker) across the pool and returns once all of them have finished.
+void threadpool_run(ThreadPool* pool, PoolTask task, void* ctx, size_t task_count);
+void threadpool_destroy(ThreadPool* pool);
+
+// Audio.
+
+AudiodataMany* audiodata_split_channels(const Audiodata* ad);
+
+// The inverse of audiodata_split_channels. All channels must have the same length and sample rate.
+Audiodata* audiodata_join_channels(const AudiodataMany* am);
+void audiodata_many_destroy(AudiodataMany *am);
+
+// Check return value.
+Audiodata* audiodata_read_file(const char* fname);
+void audiodata_write_file(const char* fname, const Audiodata* ad);
+void audiodata_destroy(Audiodata* ad);
+
+// FFTW wisdom cache.
+
+// Something filename-safe that changes when the machine does, since plans measured on one CPU are
+// meaningless on another.
+void wisdom_cpu_name(char* out, size_t size);
+
+// Writes the cache if any plans were measured since it was read. Also runs at exit.
+void wisdom_save(void);
+
+// Writes the cache even if nothing new was measured, so the file exists afterwards. Returns its path, or NULL
+// if it couldn't be written.
+const char* wisdom_write(void);
+
+// Call before creating any kernels. `path` may be NULL to use the default location. If `may_block` is
+// false, sizes the cache doesn't know are planned with FFTW_ESTIMATE instead of being measured.
+void wisdom_configure(const char* path, bool may_block);
+
+// Kernels.
+
+// Only fails for a window function it doesn't know, which can only come from outside the program, like a
+// file header. Check return value in that case.
+FFTKernel* fftkernel_create(enum WindowFunction window_function, size_t window_size, size_t hop_size);
+void fftkernel_destroy(FFTKernel* fk);
+
+// Makes sure there is scratch for at least `worker_count` workers. Call it with pool->thread_count before
+// using the kernel with that pool. Not thread-safe, since it may move fk->workers.
+void fftkernel_reserve_workers(FFTKernel* fk, size_t worker_count);
+
+// Sets up `sd` for `frames` samples of audio in the interleaved layout, with room for the bins but not their
+// values. Bins it already has are reused when they are big enough, so `sd` must be zeroed or have heap bins.
+void spectrodata_init(Spectrodata* sd, const FFTKernel* fk, size_t sample_rate, size_t frames);
+
+// Frees the bins, whichever layout they're in.
+void spectrodata_free_bins(Spectrodata* sd);
+void spectrodata_destroy(Spectrodata *sd);
+void spectrodata_many_destroy(SpectrodataMany *sm);
+
+// Dirty windows.
+
+void spectrodata_mark_dirty(Spectrodata* sd, size_t first, size_t last);
+void spectrodata_clear_dirty(Spectrodata* sd);
+
+// Same as fftkernel_execute_forward, into an existing Spectrodata. Its bins are reused when they are big
+// enough, so repeating a conversion allocates nothing. `sd` must be zeroed or have heap bins. Check return value.
+bool fftkernel_execute_forward_into(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd);
+Spectrodata* fftkernel_execute_forward(const FFTKernel* fk, const Audiodata* ad);
+
+// Sets up the batched engine, which stages `batch_windows` windowed frames side by side and transforms
+// them with one FFTW call. 0 picks a batch of about 64K samples. Not thread-safe.
+void fftkernel_enable_batch(FFTKernel* fk, size_t batch_windows);
+
+// Alternative to fftkernel_execute_forward that lets FFTW transform a whole batch of windows at a time,
+// writing them straight into the Spectrodata. Results match the per-window engine to rounding, not bit
+// for bit, since FFTW may pick different algorithms for the batched plan. Needs fftkernel_enable_batch.
+Spectrodata* fftkernel_execute_forward_batched(const FFTKernel* fk, const Audiodata* ad);
+
+// Sets up the split-complex forward transform used for SPECTRO_SPLIT spectrograms. Not thread-safe.
+void fftkernel_enable_split(FFTKernel* fk);
+
+// Like fftkernel_execute_forward, but the result is in the split-complex layout. Needs fftkernel_enable_split.
+Spectrodata* fftkernel_execute_forward_split(const FFTKernel* fk, const Audiodata* ad);
+
+// Converts `sd` to the split-complex layout in place. `spec_size` is fk->window_size / 2 + 1.
+void spectrodata_to_split(Spectrodata* sd, size_t spec_size);
+
+// Converts `sd` back to the interleaved layout in place. `spec_size` is fk->window_size / 2 + 1.
+void spectrodata_to_interleaved(Spectrodata* sd, size_t spec_size);
+
+// Spectral masking: scales bin i of every window by gains[i]. There are spec_size gains.
+void spectrodata_apply_mask(Spectrodata* sd, const sample* gains, size_t spec_size);
+
+// Same as fftkernel_execute_forward, and bit-identical to it, but the windows are split across `pool`.
+// The kernel must have scratch for every worker; see fftkernel_reserve_workers.
+Spectrodata* fftkernel_execute_forward_parallel(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad);
+
+// Incremental forward.
+
+// The windows whose support overlaps samples [start, end): [*first, *last).
+void fftkernel_windows_touching(const FFTKernel* fk, size_t window_count, size_t start, size_t end, size_t* first, size_t* last);
+
+// Re-transforms the windows of `sd` that overlap samples [start, end) of `ad`, which is what `sd` was made from
+// with only those samples changed. The recomputed windows match the audio again, so they are no longer dirty.
+// Returns how many windows were recomputed; fftkernel_windows_touching says which.
+size_t fftkernel_update_forward(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd, size_t start, size_t end);
+
+// Like fftkernel_update_forward, for an edit that replaced `removed` samples at `at` with `inserted` new ones.
+// `ad` is the audio after the edit and `sd` the spectrogram from before it; `sd` is resized to match. When the
+// length changes by a multiple of the hop, the windows after the edit are moved rather than recomputed, and
+// keep their dirty bits. Returns how many windows were recomputed.
+size_t fftkernel_update_forward_resized(const FFTKernel* fk, const Audiodata* ad, Spectrodata* sd,
+                                        size_t at, size_t removed, size_t inserted);
+
+// Streaming input.
+
+typedef struct AudioStream AudioStream;
+
+// Check return value. The stream is laid out for `fk`, and only works with kernels of the same window and hop size.
+AudioStream* audiostream_open(const char* fname, const FFTKernel* fk);
+void audiostream_close(AudioStream* as);
+
+// Takes `count` windows of one channel, starting at window `first`, as count * (window_size / 2 + 1) bins one
+// window after another. The bins are only valid during the call.
+typedef void (*SpectroSink)(void* ctx, int channel, size_t first, size_t count, const FFTW(complex)* bins);
+
+// Transforms every channel of the stream, one window at a time, and passes them to `sink` in order, a block per
+// channel at a time. Window w of each channel is bit-identical to window w of fftkernel_execute_forward on that
+// channel of the whole file. Besides the stream, this only ever holds one block of bins per channel.
+void fftkernel_forward_stream_to(const FFTKernel* fk, AudioStream* as, SpectroSink sink, void* ctx);
+
+// fftkernel_forward_stream_to, collected into a Spectrodata per channel. The result is identical to splitting
+// the channels of the whole file and running fftkernel_execute_forward on each of them, and of course takes
+// as much memory as that.
+SpectrodataMany* fftkernel_execute_forward_stream(const FFTKernel* fk, AudioStream* as);
+
+// Live input.
+
+typedef struct {
+    // Interleaved frames. Frame f is at ring[(f & (capacity - 1)) * channels].
+    sample* ring;
+    size_t capacity;
+    int channels;
+
+    // Frame counts since the start, never wrapped. The producer owns head and the consumer owns tail; each only
+    // reads the other's. They sit on their own cache lines so the two threads don't fight over one.
+    _Alignas(64) atomic_size_t head;
+    atomic_size_t dropped;
+    atomic_bool finished;
+    _Alignas(64) atomic_size_t tail;
+
+    // Consumer side.
+    const FFTKernel* fk;
+    size_t windows_emitted;
+
+    // The most frames that had come in after a window's last sample before the window went out. The worst
+    // latency for any sample is window_size frames plus this.
+    size_t max_lag;
+} LiveAnalyzer;
+
+// Check return value. Up to `max_block` frames can be pushed at a time without any being dropped, as long as
+// the analysis thread keeps up. The analyzer uses the kernel's own buffers, so nothing else may run `fk` meanwhile.
+LiveAnalyzer* live_analyzer_create(const FFTKernel* fk, int channels, size_t max_block);
+void live_analyzer_destroy(LiveAnalyzer* la);
+
+// Audio thread. Copies up to `frames` interleaved frames into the ring and returns how many fit. Whatever
+// doesn't fit is counted in `dropped`; a live input can't wait, so it's up to the caller to lose it.
+size_t live_analyzer_push(LiveAnalyzer* la, const sample* block, size_t frames);
+
+// Audio thread. How many frames a push could take right now without dropping any.
+size_t live_analyzer_space(LiveAnalyzer* la);
+
+// Audio thread. Marks the end of the input, so the last windows can go out zero-padded.
+void live_analyzer_finish(LiveAnalyzer* la);
+
+// Analysis thread. If the next window is ready, writes its bins to `out`, one channel after another with
+// fk->window_size / 2 + 1 bins each, and returns true. After live_analyzer_finish this pads out the windows
+// that run past the end, and gives the same windows fftkernel_execute_forward would for the whole input.
+bool live_analyzer_poll(LiveAnalyzer* la, FFTW(complex)* out);
+
+// Resynthesis.
+
+// Same as fftkernel_execute_reverse, into an existing Audiodata whose samples are reused when big enough.
+// `ad` must be zeroed or have samples from the buffer pool.
+void fftkernel_execute_reverse_into(const FFTKernel* fk, const Spectrodata* sd, Audiodata* ad);
+Audiodata* fftkernel_execute_reverse(const FFTKernel* fk, const Spectrodata* sd);
+
+// Same as fftkernel_execute_reverse, and bit-identical to it for any pool size: every range of windows
+// accumulates into its own slice of the output, then the overlapping edges are merged in window order.
+// The kernel must have scratch for every worker; see fftkernel_reserve_workers.
+Audiodata* fftkernel_execute_reverse_parallel(const FFTKernel* fk, ThreadPool* pool, const Spectrodata* sd);
+
+// Patches `ad`, which must be what fftkernel_execute_reverse gave for `sd` before its dirty windows were
+// edited, so it matches the edited `sd` again. Only the samples under dirty windows are recomputed, along with
+// the other windows overlapping them. Clears the dirty windows. Returns the number of samples rewritten.
+size_t fftkernel_execute_reverse_dirty(const FFTKernel* fk, Spectrodata* sd, Audiodata* ad);
+
+// Multichannel.
+
+// Transforms every channel of `am` at once. Each result is bit-identical to fftkernel_execute_forward on that channel.
+SpectrodataMany* fftkernel_execute_forward_many(const FFTKernel* fk, ThreadPool* pool, const AudiodataMany* am);
+
+// Resynthesizes every channel of `sm` at once. Each result is bit-identical to fftkernel_execute_reverse on that channel.
+AudiodataMany* fftkernel_execute_reverse_many(const FFTKernel* fk, ThreadPool* pool, const SpectrodataMany* sm);
+
+// Transforms every channel of interleaved audio at once, reading the samples in place instead of splitting
+// the channels first. Each result is bit-identical to audiodata_split_channels followed by
+// fftkernel_execute_forward on that channel.
+SpectrodataMany* fftkernel_execute_forward_interleaved(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad);
+
+// Phase vocoder.
+
+typedef struct PhaseVocoder PhaseVocoder;
+
+// Check return value. Stretches time by `stretch` and shifts pitch by `semitones`. The analysis hop is
+// fk->hop_size, and the synthesis hop is that times stretch * 2^(semitones / 12), which has to stay within half
+// the window. A quarter of the window or less sounds best.
+PhaseVocoder* vocoder_create(const FFTKernel* fk, double stretch, double semitones);
+void vocoder_destroy(PhaseVocoder* pv);
+
+// An upper bound on how many samples vocoder_process can write for `frames` frames of input, or vocoder_finish
+// after it.
+size_t vocoder_max_output(const PhaseVocoder* pv, size_t frames);
+
+// Feeds `frames` samples, `stride` apart, and writes whatever output is finished to `out`. Returns how many
+// samples that was, which is at most vocoder_max_output(pv, frames).
+size_t vocoder_process(PhaseVocoder* pv, const sample* in, size_t stride, size_t frames, sample* out);
+
+// Runs the windows that reach past the end of the input, zero-padded, and writes the rest of the output. All
+// together the output is frames_in * synthesis_hop / hop_size / pitch samples, rounded.
+size_t vocoder_finish(PhaseVocoder* pv, sample* out);
+
+// Stretches time by `stretch` and shifts pitch by `semitones` on every channel of `ad` at once, each channel
+// streaming through its own vocoder on its own task. Check return value.
+Audiodata* vocoder_stretch(const FFTKernel* fk, ThreadPool* pool, const Audiodata* ad, double stretch, double semitones);
+
+// Phase reconstruction.
+
+typedef struct {
+    size_t max_iterations;
+
+    // 0 is plain Griffin-Lim. Close to 1 converges much faster.
+    double momentum;
+
+    // Stop once the spectral convergence, || |C| - A || / ||A|| for the resynthesized spectrogram C and the
+    // target magnitudes A, is below this. 0 runs every iteration.
+    double tolerance;
+
+    // Start from random phases instead of the ones in the spectrogram. Magnitude-only input has none worth keeping.
+    bool random_phase;
+} PhaseOptions;
+
+extern const PhaseOptions phase_defaults;
+
+// Replaces the phases of `sd` with ones consistent with its magnitudes, keeping the magnitudes. `opt` may be NULL
+// for the defaults. Returns the number of iterations run, and the final spectral convergence in *convergence if
+// it isn't NULL. Every window comes back marked dirty. The kernel must have scratch for every worker; see
+// fftkernel_reserve_workers.
+size_t fftkernel_reconstruct_phase(const FFTKernel* fk, ThreadPool* pool, Spectrodata* sd, const PhaseOptions* opt, double* convergence);
+
+// The spectrogram file format.
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t window_type;
+    uint32_t channels;
+
+    uint64_t sample_rate;
+    uint64_t original_length;
+    uint64_t window_count;
+    uint64_t window_size;
+    uint64_t hop_size;
+
+    // Where the bins start. Always a multiple of 64.
+    uint64_t data_offset;
+} SpectroFileHeader;
+
+// All channels must come from `fk`, and have the same length.
+bool spectrodata_write_file(const char* fname, const FFTKernel* fk, const SpectrodataMany* sm);
+
+typedef struct SpectroFileWriter SpectroFileWriter;
+
+// Check return value. Writes the header for `channels` channels of `frames` frames analyzed with `fk`.
+SpectroFileWriter* spectro_file_writer_open(const char* fname, const FFTKernel* fk, int channels, size_t sample_rate, size_t frames);
+
+// Writes `count` windows of `channel`, starting at window `first`. Has the signature of a SpectroSink, so it can
+// be handed straight to fftkernel_forward_stream_to. After a failure it does nothing; see spectro_file_writer_close.
+void spectro_file_write_windows(void* ctx, int channel, size_t first, size_t count, const FFTW(complex)* bins);
+
+// Returns whether everything was written.
+bool spectro_file_writer_close(SpectroFileWriter* w);
+
+// Check return value. Opens a spectrogram file without reading it: the returned Spectrodata point straight into
+// the mapping, and pages are only read in as windows are touched. If `writable`, changes to the bins go back to
+// the file. The header is copied to `header` so the caller can make a matching kernel.
+SpectrodataMany* spectrodata_map_file(const char* fname, bool writable, SpectroFileHeader* header);
+
+// Pipelined analysis.
+
+// Seconds each stage spent working, not counting time spent waiting on the others.
+typedef struct {
+    double decode;
+    double compute;
+    double write;
+    double wall;
+} PipelineStats;
+
+// Converts the audio file `input` into the spectrogram file `output`, byte for byte the same as
+// fftkernel_forward_stream_to into a SpectroFileWriter, but with the decoding, the transforms and the writing
+// overlapped. The kernel must have scratch for every worker. If `stats` isn't NULL, the time each stage spent
+// working goes there. Check return value.
+bool fftkernel_forward_file(const FFTKernel* fk, ThreadPool* pool, const char* input, const char* output, PipelineStats* stats);
+
+#endif
@@ -0,0 +1,394 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include "filterbank.h"
+#include "pool.h"
+#include "trace.h"
+#include "simd.h"
+
+// Filterbanks.
+// Mel and constant-Q views project the window_size / 2 + 1 linear bins of each window onto a few dozen or hundred
+// perceptual bands. Each band only covers a run of neighbouring bins, so the projection is a sparse matrix, kept in
+// CSR form: row b lists the bins of band b and their weights. It depends only on the scale, the sample rate, the
+// window size and the band count, so each one is built once and cached for the life of the process.
+// The lowest constant-Q band is centred on C1.
+#define CQT_MIN_FREQUENCY 32.703
+
+// y[r] = sum of weights[j] * x[cols[j]] over j in [row_start[r], row_start[r + 1]), for `rows` rows.
+typedef void (*SpmvKernel)(sample* y, const uint32_t* row_start, const uint32_t* cols, const sample* weights, const sample* x, size_t rows);
+
+// Every kernel sums a row in eight lanes, lane j % 8 taking element j, and adds the lanes up in the same order,
+// so they all produce the same bits.
+static inline sample spmv_reduce(const sample* lane) {
+    return ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+}
+
+static void spmv_kernel_scalar(sample* y, const uint32_t* row_start, const uint32_t* cols, const sample* weights, const sample* x, size_t rows) {
+    for (size_t r = 0; r < rows; r++) {
+        sample lane[8] = { 0 };
+        for (uint32_t j = row_start[r]; j < row_start[r + 1]; j++)
+            lane[(j - row_start[r]) % 8] += weights[j] * x[cols[j]];
+        y[r] = spmv_reduce(lane);
+    }
+}
+
+#ifdef HAVE_X86_DISPATCH
+__attribute__((target("avx2")))
+static void spmv_kernel_avx2(sample* y, const uint32_t* row_start, const uint32_t* cols, const sample* weights, const sample* x, size_t rows) {
+    for (size_t r = 0; r < rows; r++) {
+        const uint32_t start = row_start[r], end = row_start[r + 1];
+        __m256 acc = _mm256_setzero_ps();
+        uint32_t j = start;
+        for (; j + 8 <= end; j += 8) {
+            const __m256i idx = _mm256_loadu_si256((const __m256i*)(cols + j));
+            const __m256 v = _mm256_i32gather_ps(x, idx, sizeof(float));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weights + j), v));
+        }
+
+        float lane[8];
+        _mm256_storeu_ps(lane, acc);
+        for (; j < end; j++)
+            lane[j - (end - (end - start) % 8)] += weights[j] * x[cols[j]];
+        y[r] = spmv_reduce(lane);
+    }
+}
+#endif
+
+static SpmvKernel spmv_kernel_select(void) {
+    if (getenv("FOURIEDIT_NO_SIMD"))
+        return spmv_kernel_scalar;
+
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return spmv_kernel_avx2;
+#endif
+    return spmv_kernel_scalar;
+}
+
+struct Filterbank {
+    enum FilterbankScale scale;
+    size_t sample_rate;
+    size_t window_size;
+    size_t bands;
+    size_t spec_size;
+    SpmvKernel spmv;
+
+    // bands + 1 offsets into cols and weights. Each row's weights add up to 1, so a band is the weighted mean
+    // of the magnitudes under it.
+    uint32_t* row_start;
+    uint32_t* cols;
+    sample* weights;
+
+    // The transpose, with spec_size + 1 offsets and each row again adding up to 1: a bin goes back as the
+    // weighted mean of the bands over it. Bins no band covers have empty rows.
+    uint32_t* inv_row_start;
+    uint32_t* inv_cols;
+    sample* inv_weights;
+
+    struct Filterbank* next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    Filterbank* head;
+} filterbank_cache = { PTHREAD_MUTEX_INITIALIZER, NULL };
+
+static double hz_to_mel(double hz) {
+    return 2595 * log10(1 + hz / 700);
+}
+
+static double mel_to_hz(double mel) {
+    return 700 * (pow(10, mel / 2595) - 1);
+}
+
+// Band b rises from edges[b] to a peak at edges[b + 1] and falls back to zero at edges[b + 2].
+static double filterbank_shape(enum FilterbankScale scale, const double* edges, size_t b, double hz) {
+    const double lo = edges[b], mid = edges[b + 1], hi = edges[b + 2];
+    if (hz <= lo || hz >= hi)
+        return 0;
+    if (scale == FB_MEL)
+        return hz < mid ? (hz - lo) / (mid - lo) : (hi - hz) / (hi - mid);
+
+    // Hann in log frequency, which makes the bandwidth proportional to the centre.
+    return 0.5 - 0.5 * cos(2 * M_PI * log(hz / lo) / log(hi / lo));
+}
+
+static Filterbank* filterbank_build(enum FilterbankScale scale, size_t sample_rate, size_t window_size, size_t bands) {
+    Filterbank* fb = calloc(1, sizeof(Filterbank));
+    assert(fb);
+    fb->scale = scale;
+    fb->sample_rate = sample_rate;
+    fb->window_size = window_size;
+    fb->bands = bands;
+    fb->spec_size = window_size / 2 + 1;
+    fb->spmv = spmv_kernel_select();
+
+    const double nyquist = sample_rate / 2.0;
+    const double bin_hz = (double)sample_rate / window_size;
+    double* edges = malloc((bands + 2) * sizeof(double));
+    assert(edges);
+    for (size_t i = 0; i < bands + 2; i++) {
+        const double t = (double)i / (bands + 1);
+        edges[i] = scale == FB_MEL ? mel_to_hz(t * hz_to_mel(nyquist))
+                                   : CQT_MIN_FREQUENCY * pow(nyquist / CQT_MIN_FREQUENCY, t);
+    }
+
+    // Bands narrower than a bin would come out empty; those get the bin nearest their centre instead.
+    fb->row_start = calloc(bands + 1, sizeof(uint32_t));
+    assert(fb->row_start);
+    size_t nonzeros = 0;
+    for (size_t b = 0; b < bands; b++) {
+        const size_t first = (size_t)ceil(edges[b] / bin_hz);
+        const size_t last = MIN((size_t)floor(edges[b + 2] / bin_hz) + 1, fb->spec_size);
+        size_t count = 0;
+        for (size_t k = first; k < last; k++)
+            count += filterbank_shape(scale, edges, b, k * bin_hz) > 0;
+        nonzeros += count > 0 ? count : 1;
+        fb->row_start[b + 1] = nonzeros;
+    }
+
+    fb->cols = malloc(nonzeros * sizeof(uint32_t));
+    fb->weights = malloc(nonzeros * sizeof(sample));
+    assert(fb->cols && fb->weights);
+    for (size_t b = 0; b < bands; b++) {
+        const size_t first = (size_t)ceil(edges[b] / bin_hz);
+        const size_t last = MIN((size_t)floor(edges[b + 2] / bin_hz) + 1, fb->spec_size);
+        size_t j = fb->row_start[b];
+        double sum = 0;
+        for (size_t k = first; k < last; k++) {
+            const double w = filterbank_shape(scale, edges, b, k * bin_hz);
+            if (w > 0) {
+                fb->cols[j] = k;
+                fb->weights[j++] = w;
+                sum += w;
+            }
+        }
+        if (j == fb->row_start[b]) {
+            fb->cols[j] = MIN((size_t)round(edges[b + 1] / bin_hz), fb->spec_size - 1);
+            fb->weights[j] = 1;
+            sum = 1;
+        }
+        for (j = fb->row_start[b]; j < fb->row_start[b + 1]; j++)
+            fb->weights[j] /= sum;
+    }
+    free(edges);
+
+    // The transpose, built by counting the entries in each column first. Filling it row by row keeps each
+    // column's bands in order.
+    fb->inv_row_start = calloc(fb->spec_size + 1, sizeof(uint32_t));
+    fb->inv_cols = malloc(nonzeros * sizeof(uint32_t));
+    fb->inv_weights = malloc(nonzeros * sizeof(sample));
+    assert(fb->inv_row_start && fb->inv_cols && fb->inv_weights);
+    for (size_t j = 0; j < nonzeros; j++)
+        fb->inv_row_start[fb->cols[j] + 1]++;
+    for (size_t k = 0; k < fb->spec_size; k++)
+        fb->inv_row_start[k + 1] += fb->inv_row_start[k];
+
+    uint32_t* fill = malloc(fb->spec_size * sizeof(uint32_t));
+    assert(fill);
+    memcpy(fill, fb->inv_row_start, fb->spec_size * sizeof(uint32_t));
+    for (size_t b = 0; b < bands; b++) {
+        for (uint32_t j = fb->row_start[b]; j < fb->row_start[b + 1]; j++) {
+            const uint32_t at = fill[fb->cols[j]]++;
+            fb->inv_cols[at] = b;
+            fb->inv_weights[at] = fb->weights[j];
+        }
+    }
+    free(fill);
+
+    for (size_t k = 0; k < fb->spec_size; k++) {
+        double sum = 0;
+        for (uint32_t j = fb->inv_row_start[k]; j < fb->inv_row_start[k + 1]; j++)
+            sum += fb->inv_weights[j];
+        for (uint32_t j = fb->inv_row_start[k]; j < fb->inv_row_start[k + 1]; j++)
+            fb->inv_weights[j] /= sum;
+    }
+    return fb;
+}
+
+const Filterbank* filterbank_get(enum FilterbankScale scale, size_t sample_rate, size_t window_size, size_t bands) {
+    const double nyquist = sample_rate / 2.0;
+    if (bands == 0 || window_size < 2 || sample_rate == 0 || (scale == FB_CQT && nyquist <= CQT_MIN_FREQUENCY)) {
+        fprintf(stderr, "Can't make a filterbank of %zu bands for a window of %zu at %zu Hz.\n", bands, window_size, sample_rate);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&filterbank_cache.lock);
+    Filterbank* fb = filterbank_cache.head;
+    while (fb && !(fb->scale == scale && fb->sample_rate == sample_rate && fb->window_size == window_size && fb->bands == bands))
+        fb = fb->next;
+    if (!fb) {
+        fb = filterbank_build(scale, sample_rate, window_size, bands);
+        fb->next = filterbank_cache.head;
+        filterbank_cache.head = fb;
+    }
+    pthread_mutex_unlock(&filterbank_cache.lock);
+    return fb;
+}
+
+void filterbank_cache_clear(void) {
+    pthread_mutex_lock(&filterbank_cache.lock);
+    while (filterbank_cache.head) {
+        Filterbank* fb = filterbank_cache.head;
+        filterbank_cache.head = fb->next;
+        free(fb->row_start);
+        free(fb->cols);
+        free(fb->weights);
+        free(fb->inv_row_start);
+        free(fb->inv_cols);
+        free(fb->inv_weights);
+        free(fb);
+    }
+    pthread_mutex_unlock(&filterbank_cache.lock);
+}
+
+// Band magnitudes: `bands` values per window, one window after another.
+struct Banddata {
+    size_t window_count;
+    size_t bands;
+    sample* data;
+};
+
+void banddata_destroy(Banddata* bd) {
+    pool_free(bd->data);
+    free(bd);
+}
+
+typedef struct {
+    const Filterbank* fb;
+    const Banddata* bd;
+    Spectrodata* sd;
+    size_t task_count;
+
+    // spec_size samples for each task.
+    sample* scratch;
+} BandJob;
+
+static void band_job_range(const BandJob* job, size_t task, size_t* first, size_t* last) {
+    *first = job->sd->window_count * task / job->task_count;
+    *last = job->sd->window_count * (task + 1) / job->task_count;
+}
+
+static void band_project_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    const BandJob* job = ctx;
+    const Filterbank* fb = job->fb;
+    const Spectrodata* sd = job->sd;
+    sample* mags = job->scratch + task * fb->spec_size;
+    size_t first, last;
+    band_job_range(job, task, &first, &last);
+
+    for (size_t w = first; w < last; w++) {
+        const size_t offset = w * fb->spec_size;
+        if (sd->layout == SPECTRO_SPLIT) {
+            for (size_t k = 0; k < fb->spec_size; k++)
+                mags[k] = sqrt(sd->re[offset + k] * sd->re[offset + k] + sd->im[offset + k] * sd->im[offset + k]);
+        } else {
+            for (size_t k = 0; k < fb->spec_size; k++)
+                mags[k] = sqrt(sd->data[offset + k][0] * sd->data[offset + k][0] + sd->data[offset + k][1] * sd->data[offset + k][1]);
+        }
+        fb->spmv(job->bd->data + w * fb->bands, fb->row_start, fb->cols, fb->weights, mags, fb->bands);
+    }
+}
+
+static void band_unproject_task(void* ctx, size_t task, size_t worker) {
+    (void)worker;
+    const BandJob* job = ctx;
+    const Filterbank* fb = job->fb;
+    Spectrodata* sd = job->sd;
+    sample* mags = job->scratch + task * fb->spec_size;
+    size_t first, last;
+    band_job_range(job, task, &first, &last);
+
+    for (size_t w = first; w < last; w++) {
+        fb->spmv(mags, fb->inv_row_start, fb->inv_cols, fb->inv_weights, job->bd->data + w * fb->bands, fb->spec_size);
+
+        // Each bin keeps its phase and takes the new magnitude. Bins outside every band are left alone.
+        const size_t offset = w * fb->spec_size;
+        for (size_t k = 0; k < fb->spec_size; k++) {
+            if (fb->inv_row_start[k] == fb->inv_row_start[k + 1])
+                continue;
+            sample* re = sd->layout == SPECTRO_SPLIT ? &sd->re[offset + k] : &sd->data[offset + k][0];
+            sample* im = sd->layout == SPECTRO_SPLIT ? &sd->im[offset + k] : &sd->data[offset + k][1];
+            const sample mag = sqrt(*re * *re + *im * *im);
+            if (mag > 0) {
+                *re *= mags[k] / mag;
+                *im *= mags[k] / mag;
+            } else {
+                *re = mags[k];
+                *im = 0;
+            }
+        }
+    }
+}
+
+static void band_job_run(BandJob* job, ThreadPool* pool, PoolTask task) {
+    job->task_count = MIN(pool->thread_count * 4, job->sd->window_count);
+    if (job->task_count == 0)
+        return;
+    job->scratch = pool_alloc(job->task_count * job->fb->spec_size * sizeof(sample));
+    threadpool_run(pool, task, job, job->task_count);
+    pool_free(job->scratch);
+}
+
+Banddata* filterbank_project(const Filterbank* fb, ThreadPool* pool, const Spectrodata* sd) {
+    TRACE_SCOPE("band_project");
+    Banddata* bd = calloc(1, sizeof(Banddata));
+    assert(bd);
+    bd->window_count = sd->window_count;
+    bd->bands = fb->bands;
+    bd->data = pool_alloc(sd->window_count * fb->bands * sizeof(sample));
+
+    BandJob job = { .fb = fb, .bd = bd, .sd = (Spectrodata*)sd };
+    band_job_run(&job, pool, band_project_task);
+    return bd;
+}
+
+void filterbank_unproject(const Filterbank* fb, ThreadPool* pool, const Banddata* bd, Spectrodata* sd) {
+    TRACE_SCOPE("band_unproject");
+    assert(bd->bands == fb->bands && bd->window_count == sd->window_count);
+
+    BandJob job = { .fb = fb, .bd = bd, .sd = sd };
+    band_job_run(&job, pool, band_unproject_task);
+    spectrodata_mark_dirty(sd, 0, sd->window_count);
+}
+
+void banddata_render(const Banddata* bd, Imagedata* out, const RenderOptions* opt) {
+    TRACE_SCOPE("render_bands");
+    render_setup();
+
+    if (!opt)
+        opt = &render_defaults;
+    const Colormap* cm = opt->colormap ? opt->colormap : default_colormap;
+
+    const size_t width = bd->window_count;
+    const size_t bands = bd->bands;
+    imagedata_resize(out, (int)width, (int)bands, cm->channels);
+
+    // The level kernels take complex values; band magnitudes are real.
+    const LevelMapping m = level_mapping(opt, cm->size);
+    uint16_t* levels = malloc(RENDER_TILE * bands * sizeof(uint16_t));
+    sample* zeros = calloc(bands, sizeof(sample));
+    assert(levels && zeros);
+
+    const size_t row_bytes = width * cm->channels;
+    for (size_t x0 = 0; x0 < width; x0 += RENDER_TILE) {
+        const size_t count = MIN(RENDER_TILE, width - x0);
+        for (size_t x = 0; x < count; x++)
+            level_kernel(levels + x * bands, NULL, bd->data + (x0 + x) * bands, zeros, bands, m);
+
+        for (size_t b = 0; b < bands; b++) {
+            uint8_t* row = out->data + (bands - 1 - b) * row_bytes + x0 * cm->channels;
+            colormap_fill_row(row, cm, levels + b, bands, count);
+        }
+    }
+
+    free(zeros);
+    free(levels);
+}
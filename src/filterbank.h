@@ -0,0 +1,39 @@
+#ifndef FOURIEDIT_FILTERBANK_H
+#define FOURIEDIT_FILTERBANK_H
+
+#include <stddef.h>
+#include "fft.h"
+#include "render.h"
+
+// Filterbanks.
+
+enum FilterbankScale {
+    FB_MEL,
+    FB_CQT,
+};
+
+typedef struct Filterbank Filterbank;
+
+// The filterbank for these parameters, building it the first time. It belongs to the cache; don't free it.
+// Returns NULL if the parameters make no sense.
+const Filterbank* filterbank_get(enum FilterbankScale scale, size_t sample_rate, size_t window_size, size_t bands);
+
+// Frees every cached filterbank. Nothing from filterbank_get may be in use.
+void filterbank_cache_clear(void);
+
+typedef struct Banddata Banddata;
+
+void banddata_destroy(Banddata* bd);
+
+// Projects the magnitudes of every window of `sd` onto the bands of `fb`, which must be for the same window size.
+Banddata* filterbank_project(const Filterbank* fb, ThreadPool* pool, const Spectrodata* sd);
+
+// The approximate inverse: sets the magnitude of every bin of `sd` to the weighted mean of the bands over it in
+// `bd`, keeping its phase, and marks every window dirty. Projecting, editing the bands and coming back this way
+// only changes the bins the edited bands cover; a flat band comes back flat.
+void filterbank_unproject(const Filterbank* fb, ThreadPool* pool, const Banddata* bd, Spectrodata* sd);
+
+// Draws band magnitudes in decibels, like spectro_render_magnitude, with the lowest band on the bottom row.
+void banddata_render(const Banddata* bd, Imagedata* out, const RenderOptions* opt);
+
+#endif
@@ -0,0 +1,1566 @@
+#include <assert.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sndfile.h>
+#include "fft.h"
+#include "filterbank.h"
+#include "pool.h"
+#include "render.h"
+#include "sample_io.h"
+#include "trace.h"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+// Pick the entry point with -DMAIN1, -DMAIN2 or -DMAIN_CLI. The CLI is the default.
+#if !defined(MAIN1) && !defined(MAIN2) && !defined(MAIN_CLI)
+#define MAIN_CLI
+#endif
+
+#ifdef MAIN1
+int main() {
+    printf("Hello world!");
+    FFTKernel *fk = fftkernel_create(WF_HANN, 4096, 2048);
+
+    Audiodata *ad = audiodata_read_file("bin\\test.wav");
+    assert(ad);
+
+    AudiodataMany *am = audiodata_split_channels(ad);
+
+    Spectrodata *sd = fftkernel_execute_forward(fk, &am->data[0]);
+    assert(sd);
+
+    Audiodata *ad2 = fftkernel_execute_reverse(fk, sd);
+    assert(ad2);
+
+    printf("Got here.\n");
+    audiodata_write_file("bin\\test_out.wav", ad2);
+
+    audiodata_destroy(ad);
+    audiodata_many_destroy(am);
+    fftkernel_destroy(fk);
+    spectrodata_destroy(sd);
+
+    return 0;
+}
+#endif
+
+#ifdef MAIN2
+int main() {
+    printf("Hello world!");
+    FFTKernel *fk = fftkernel_create(WF_HANN, 4096, 2048);
+
+    Spectrodata sd = {
+        .data = calloc(1000 * (fk->window_size / 2 + 1), sizeof(FFTW(complex))),
+        .original_length = 100 * (fk->window_size),
+        .sample_rate = 44100,
+        .window_count = 1000
+    };
+
+    /*for (int i = 0; i < 1000; i++) {
+        sd.data[100 + i * (fk->window_size / 2 + 1)][0] = 0.001f;  // real part
+        sd.data[100 + i * (fk->window_size / 2 + 1)][1] = 0.0f;  // imag part
+    }*/
+
+    Audiodata *ad2 = fftkernel_execute_reverse(fk, &sd);
+    assert(ad2);
+
+    printf("Got here.\n");
+    audiodata_write_file("bin\\test_out.wav", ad2);
+
+    fftkernel_destroy(fk);
+
+    return 0;
+}
+#endif
+
+#ifdef MAIN_CLI
+static void sleep_seconds(double seconds) {
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1e3));
+#else
+    struct timespec ts = { .tv_sec = (time_t)seconds, .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Deterministic white noise in [-1, 1), so runs are comparable.
+static Audiodata* audiodata_create_noise(size_t frames, size_t sample_rate, int channels) {
+    Audiodata* ad = calloc(1, sizeof(Audiodata));
+    assert(ad);
+    ad->sample_rate = sample_rate;
+    ad->frames = frames;
+    ad->channels = channels;
+    ad->data = pool_alloc(frames * channels * sizeof(sample));
+
+    uint32_t state = 0x12345678;
+    for (size_t i = 0; i < frames * channels; i++) {
+        state = state * 1664525u + 1013904223u;
+        ad->data[i] = (sample)(state >> 8) / (1u << 23) - 1;
+    }
+    return ad;
+}
+
+typedef struct {
+    const char* function;
+    const char* input;
+    const char* output;
+
+    enum WindowFunction window_function;
+    size_t window_size;
+    size_t hop_size;
+
+    const char* colormap;
+    size_t levels;
+    enum PhaseAccuracy phase_accuracy;
+    size_t bands;
+    bool stage_times;
+} CliOptions;
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: fouriedit [OPTIONS] -f FUNCTION -i INPUT -o OUTPUT\n"
+        "       fouriedit [OPTIONS] COMMAND ...\n"
+        "\n"
+        "functions:\n"
+        "  audio_to_spectro  Analyze an audio file into a spectrogram file.\n"
+        "  spectro_to_audio  Resynthesize a spectrogram file into a WAV file.\n"
+        "  spectro_to_image_basic\n"
+        "                    Draw the magnitude of a spectrogram file's first channel as a PAM image.\n"
+        "  spectro_to_image_domain_coloring\n"
+        "                    Same, but colored by phase.\n"
+        "  spectro_to_image_mel\n"
+        "  spectro_to_image_cqt\n"
+        "                    Draw the first channel's magnitude on --bands mel or constant-Q bands.\n"
+        "\n"
+        "commands:\n"
+        "  wisdom SIZE...    Measure and cache FFTW plans for these window sizes.\n"
+        "  compare-engines [SECONDS]\n"
+        "                    Time the per-window and batched forward engines on SECONDS (default 60)\n"
+        "                    of 48 kHz noise, for window sizes 256 to 16384 at 50%% overlap.\n"
+        "  verify [SECONDS]  Check that the threaded, multichannel and incremental paths give exactly the\n"
+        "                    same bits as the serial ones, on SECONDS (default 1) of stereo noise for several\n"
+        "                    window and hop sizes and 1, 2, 3 and one-per-CPU threads. Also checks that stretched\n"
+        "                    and pitch-shifted tones keep their level at both ends, and that phase reconstruction\n"
+        "                    leaves a consistent spectrogram consistent. Fails on any mismatch.\n"
+        "  bench [quick]     Sweep window sizes, hops, channel counts and lengths over noise, and print\n"
+        "                    the timings as JSON (to OUTPUT if -o is given). quick is a small subset.\n"
+        "  time-render [WINDOWS]\n"
+        "                    Time drawing WINDOWS (default 1000) windows of 4096 as images.\n"
+        "  live [BLOCK] [paced]\n"
+        "                    Analyze INPUT as if it were a live input arriving in blocks of up to BLOCK\n"
+        "                    (default 512) frames, at its own sample rate if paced, into the spectrogram OUTPUT.\n"
+        "  griffin-lim [ITERATIONS] [TOLERANCE]\n"
+        "                    Drop the phases of the spectrogram INPUT and rebuild them from the magnitudes with\n"
+        "                    fast Griffin-Lim, for ITERATIONS (default 50) or until the spectral convergence is\n"
+        "                    under TOLERANCE, then resynthesize into the WAV file OUTPUT.\n"
+        "  stretch RATIO [SEMITONES]\n"
+        "                    Make INPUT RATIO times as long and shift it SEMITONES up (or down, if negative)\n"
+        "                    with a phase vocoder, into the WAV file OUTPUT. --hop is the analysis hop\n"
+        "                    (default: whatever makes the synthesis hop a quarter window).\n"
+        "  batch MANIFEST [THREADS]\n"
+        "                    Run every conversion listed in MANIFEST, one per line as INPUT OUTPUT or\n"
+        "                    FUNCTION INPUT OUTPUT (default audio_to_spectro), on THREADS workers (default\n"
+        "                    one per CPU) sharing planned kernels, and print each file's time and the totals.\n"
+        "\n"
+        "options:\n"
+        "  --window N        Window size for analysis (default 4096).\n"
+        "  --hop N           Hop size for analysis (default half the window).\n"
+        "  --window-function hann|none\n"
+        "                    Window function for analysis (default hann).\n"
+        "  --colormap gray|heat\n"
+        "                    Colormap for images (default gray).\n"
+        "  --levels N        Colormap entries, 2 to 65536 (default 256).\n"
+        "  --phase fast|accurate\n"
+        "                    Phase precision for domain coloring (default fast).\n"
+        "  --bands N         Bands for the mel and constant-Q images (default 128).\n"
+        "  --fast-plan       Don't measure plans missing from the wisdom cache; estimate them instead.\n"
+        "  --wisdom FILE     Use FILE as the wisdom cache instead of the per-user default.\n"
+        "  --pool-stats      Print buffer pool hits, misses and peak size on exit.\n"
+        "  --stage-times     Print how long audio_to_spectro spent decoding, transforming and writing.\n"
+        "  --trace FILE      Write a Chrome trace of every stage to FILE (needs -DFOURIEDIT_TRACE).\n");
+}
+
+// What conversions run on. Kernels are made the first time a conversion asks for them and kept until the
+// context is cleared, so a batch of files with the same parameters plans each size once, not once per file.
+// The pool is made on first use too; pool_threads is its size, 0 for one worker per CPU.
+typedef struct {
+    size_t pool_threads;
+    ThreadPool* pool;
+
+    FFTKernel** kernels;
+    size_t kernel_count;
+} ConvertContext;
+
+static ThreadPool* convert_pool(ConvertContext* ctx) {
+    if (!ctx->pool)
+        ctx->pool = threadpool_create(ctx->pool_threads);
+    return ctx->pool;
+}
+
+// The kernel for these parameters, with scratch for every worker of the context's pool. Owned by the context.
+// NULL only when fftkernel_create fails.
+static FFTKernel* convert_kernel(ConvertContext* ctx, enum WindowFunction window_function, size_t window_size, size_t hop_size) {
+    for (size_t i = 0; i < ctx->kernel_count; i++) {
+        FFTKernel* fk = ctx->kernels[i];
+        if (fk->window_type == window_function && fk->window_size == window_size && fk->hop_size == hop_size)
+            return fk;
+    }
+
+    FFTKernel* fk = fftkernel_create(window_function, window_size, hop_size);
+    if (!fk)
+        return NULL;
+    fftkernel_reserve_workers(fk, convert_pool(ctx)->thread_count);
+    ctx->kernels = realloc(ctx->kernels, (ctx->kernel_count + 1) * sizeof(FFTKernel*));
+    assert(ctx->kernels);
+    ctx->kernels[ctx->kernel_count++] = fk;
+    return fk;
+}
+
+typedef int (*Conversion)(const CliOptions* opt, ConvertContext* ctx);
+
+static void convert_context_clear(ConvertContext* ctx) {
+    for (size_t i = 0; i < ctx->kernel_count; i++)
+        fftkernel_destroy(ctx->kernels[i]);
+    free(ctx->kernels);
+    if (ctx->pool)
+        threadpool_destroy(ctx->pool);
+    *ctx = (ConvertContext){ .pool_threads = ctx->pool_threads };
+}
+
+static int convert_audio_to_spectro(const CliOptions* opt, ConvertContext* ctx) {
+    FFTKernel* fk = convert_kernel(ctx, opt->window_function, opt->window_size, opt->hop_size);
+
+    PipelineStats stats;
+    bool ok = fftkernel_forward_file(fk, convert_pool(ctx), opt->input, opt->output, &stats);
+    if (ok && opt->stage_times)
+        fprintf(stderr, "decode %.3f s, transform %.3f s, write %.3f s, wall %.3f s\n",
+                stats.decode, stats.compute, stats.write, stats.wall);
+    return ok ? 0 : 1;
+}
+
+static int convert_spectro_to_audio(const CliOptions* opt, ConvertContext* ctx) {
+    SpectroFileHeader header;
+    SpectrodataMany* sm = spectrodata_map_file(opt->input, false, &header);
+    if (!sm)
+        return 1;
+
+    // The file decides the kernel; the analysis options don't apply.
+    FFTKernel* fk = convert_kernel(ctx, header.window_type, header.window_size, header.hop_size);
+    if (!fk) {
+        spectrodata_many_destroy(sm);
+        return 1;
+    }
+
+    AudiodataMany am = { .count = sm->count, .data = calloc(sm->count, sizeof(Audiodata)) };
+    assert(am.data);
+    for (int c = 0; c < sm->count; c++) {
+        Audiodata* ad = fftkernel_execute_reverse(fk, &sm->data[c]);
+        am.data[c] = *ad;
+        free(ad);
+    }
+
+    Audiodata* ad = audiodata_join_channels(&am);
+    audiodata_write_file(opt->output, ad);
+
+    audiodata_destroy(ad);
+    for (int c = 0; c < am.count; c++)
+        pool_free(am.data[c].data);
+    free(am.data);
+    spectrodata_many_destroy(sm);
+    return 0;
+}
+
+static Colormap* colormap_for(const CliOptions* opt) {
+    if (opt->colormap && !strcmp(opt->colormap, "heat"))
+        return colormap_create_heat(opt->levels);
+    return colormap_create_gray(opt->levels);
+}
+
+static int convert_spectro_to_image_basic(const CliOptions* opt, ConvertContext* ctx) {
+    SpectroFileHeader header;
+    SpectrodataMany* sm = spectrodata_map_file(opt->input, false, &header);
+    if (!sm)
+        return 1;
+
+    FFTKernel* fk = convert_kernel(ctx, header.window_type, header.window_size, header.hop_size);
+    if (!fk) {
+        spectrodata_many_destroy(sm);
+        return 1;
+    }
+    Colormap* cm = colormap_for(opt);
+    RenderOptions ropt = render_defaults;
+    ropt.colormap = cm;
+
+    Imagedata img = { 0 };
+    spectro_render_magnitude(fk, &sm->data[0], &img, &ropt);
+    bool ok = imagedata_write_file(opt->output, &img);
+
+    imagedata_clear(&img);
+    colormap_destroy(cm);
+    spectrodata_many_destroy(sm);
+    return ok ? 0 : 1;
+}
+
+static int convert_spectro_to_image_domain_coloring(const CliOptions* opt, ConvertContext* ctx) {
+    SpectroFileHeader header;
+    SpectrodataMany* sm = spectrodata_map_file(opt->input, false, &header);
+    if (!sm)
+        return 1;
+
+    FFTKernel* fk = convert_kernel(ctx, header.window_type, header.window_size, header.hop_size);
+    if (!fk) {
+        spectrodata_many_destroy(sm);
+        return 1;
+    }
+    RenderOptions ropt = render_defaults;
+    ropt.phase_accuracy = opt->phase_accuracy;
+
+    Imagedata img = { 0 };
+    spectro_render_domain_coloring(fk, convert_pool(ctx), &sm->data[0], &img, &ropt);
+    bool ok = imagedata_write_file(opt->output, &img);
+
+    imagedata_clear(&img);
+    spectrodata_many_destroy(sm);
+    return ok ? 0 : 1;
+}
+
+static int convert_spectro_to_image_bands(const CliOptions* opt, ConvertContext* ctx, enum FilterbankScale scale) {
+    SpectroFileHeader header;
+    SpectrodataMany* sm = spectrodata_map_file(opt->input, false, &header);
+    if (!sm)
+        return 1;
+
+    const Filterbank* fb = filterbank_get(scale, header.sample_rate, header.window_size, opt->bands);
+    if (!fb) {
+        spectrodata_many_destroy(sm);
+        return 1;
+    }
+    Colormap* cm = colormap_for(opt);
+    RenderOptions ropt = render_defaults;
+    ropt.colormap = cm;
+
+    Banddata* bd = filterbank_project(fb, convert_pool(ctx), &sm->data[0]);
+    Imagedata img = { 0 };
+    banddata_render(bd, &img, &ropt);
+    bool ok = imagedata_write_file(opt->output, &img);
+
+    imagedata_clear(&img);
+    banddata_destroy(bd);
+    colormap_destroy(cm);
+    spectrodata_many_destroy(sm);
+    return ok ? 0 : 1;
+}
+
+static int convert_spectro_to_image_mel(const CliOptions* opt, ConvertContext* ctx) {
+    return convert_spectro_to_image_bands(opt, ctx, FB_MEL);
+}
+
+static int convert_spectro_to_image_cqt(const CliOptions* opt, ConvertContext* ctx) {
+    return convert_spectro_to_image_bands(opt, ctx, FB_CQT);
+}
+
+static const struct {
+    const char* name;
+    Conversion run;
+} conversions[] = {
+    { "audio_to_spectro", convert_audio_to_spectro },
+    { "spectro_to_audio", convert_spectro_to_audio },
+    { "spectro_to_image_basic", convert_spectro_to_image_basic },
+    { "spectro_to_image_domain_coloring", convert_spectro_to_image_domain_coloring },
+    { "spectro_to_image_mel", convert_spectro_to_image_mel },
+    { "spectro_to_image_cqt", convert_spectro_to_image_cqt },
+};
+
+// Finds the function called `name`. Returns the table's copy of the name, which outlives any trace, or NULL.
+static const char* conversion_named(const char* name, Conversion* run) {
+    for (size_t i = 0; i < sizeof(conversions) / sizeof(conversions[0]); i++) {
+        if (!strcmp(conversions[i].name, name)) {
+            *run = conversions[i].run;
+            return conversions[i].name;
+        }
+    }
+    return NULL;
+}
+
+static int cmd_convert(const CliOptions* opt) {
+    if (!opt->input || !opt->output) {
+        usage();
+        return 1;
+    }
+
+    Conversion run;
+    const char* name = conversion_named(opt->function, &run);
+    if (!name) {
+        fprintf(stderr, "Unknown function '%s'.\n", opt->function);
+        return 1;
+    }
+
+    TRACE_SCOPE(name);
+    ConvertContext ctx = { 0 };
+    int status = run(opt, &ctx);
+    convert_context_clear(&ctx);
+    return status;
+}
+
+static int cmd_wisdom(int argc, char** argv) {
+    if (argc < 1) {
+        usage();
+        return 1;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        char* end;
+        unsigned long size = strtoul(argv[i], &end, 10);
+        if (*end || size < 2) {
+            fprintf(stderr, "wisdom: '%s' is not a window size.\n", argv[i]);
+            return 1;
+        }
+
+        // The hop and window shape don't affect the plans.
+        printf("Planning %lu...\n", size);
+        fftkernel_destroy(fftkernel_create(WF_NONE, size, size));
+    }
+
+    const char* path = wisdom_write();
+    if (!path)
+        return 1;
+    printf("Wrote %s\n", path);
+    return 0;
+}
+
+static int cmd_compare_engines(int argc, char** argv) {
+    double seconds = argc > 0 ? atof(argv[0]) : 60.0;
+    if (seconds <= 0) {
+        usage();
+        return 1;
+    }
+
+    Audiodata* ad = audiodata_create_noise((size_t)(seconds * 48000), 48000, 1);
+
+    printf("%8s %14s %14s %8s\n", "window", "per-window", "batched", "speedup");
+    for (size_t window_size = 256; window_size <= 16384; window_size *= 2) {
+        FFTKernel* fk = fftkernel_create(WF_HANN, window_size, window_size / 2);
+        fftkernel_enable_batch(fk, 0);
+
+        // Best of three, to keep page faults and frequency ramp-up out of it.
+        double best[2] = { 1e30, 1e30 };
+        for (int run = 0; run < 3; run++) {
+            for (int engine = 0; engine < 2; engine++) {
+                double t0 = now_seconds();
+                Spectrodata* sd = engine == 0 ? fftkernel_execute_forward(fk, ad) : fftkernel_execute_forward_batched(fk, ad);
+                double t = now_seconds() - t0;
+                spectrodata_destroy(sd);
+                if (t < best[engine])
+                    best[engine] = t;
+            }
+        }
+
+        printf("%8zu %9.1f MS/s %9.1f MS/s %7.2fx\n", window_size,
+               ad->frames / best[0] * 1e-6, ad->frames / best[1] * 1e-6, best[0] / best[1]);
+        fftkernel_destroy(fk);
+    }
+
+    audiodata_destroy(ad);
+    return 0;
+}
+
+// The hop to use without a --hop: whatever makes the synthesis hop a quarter window.
+static size_t stretch_default_hop(size_t window_size, double stretch, double semitones) {
+    const double ratio = stretch * pow(2.0, semitones / 12.0);
+    return (size_t)fmax(1.0, round(window_size / 4 / fmax(1.0, ratio)));
+}
+
+// Checks that every path claiming to be bit-identical to the serial one really is, for the kernel `fk`.
+typedef struct {
+    const FFTKernel* fk;
+    size_t checks;
+    size_t mismatches;
+} Verifier;
+
+static void verify_report(Verifier* v, bool same, const char* what, size_t threads) {
+    v->checks++;
+    if (same)
+        return;
+    v->mismatches++;
+    if (threads > 0)
+        printf("MISMATCH window %zu hop %zu, %zu threads: %s\n", v->fk->window_size, v->fk->hop_size, threads, what);
+    else
+        printf("MISMATCH window %zu hop %zu: %s\n", v->fk->window_size, v->fk->hop_size, what);
+}
+
+// Whether `n` samples are the same bits. A long double has padding on x86 that nothing initializes, so those
+// go one value at a time, telling -0 from 0 and matching NaN with NaN. The others are compared whole.
+static bool verify_same_samples(const sample* a, const sample* b, size_t n) {
+#ifdef FOURIEDIT_LONG_DOUBLE
+    for (size_t i = 0; i < n; i++) {
+        if (isnan(a[i]) ? !isnan(b[i]) : (a[i] != b[i] || signbit(a[i]) != signbit(b[i])))
+            return false;
+    }
+    return true;
+#else
+    return !memcmp(a, b, n * sizeof(sample));
+#endif
+}
+
+static void verify_bins(Verifier* v, const char* what, size_t threads, const Spectrodata* want, const Spectrodata* got) {
+    const size_t spec_size = v->fk->window_size / 2 + 1;
+    verify_report(v, got && got->window_count == want->window_count && got->original_length == want->original_length
+                     && verify_same_samples((const sample*)got->data, (const sample*)want->data, want->window_count * spec_size * 2),
+                  what, threads);
+}
+
+static void verify_audio(Verifier* v, const char* what, size_t threads, const Audiodata* want, const Audiodata* got) {
+    verify_report(v, got && got->frames == want->frames && got->channels == want->channels
+                     && verify_same_samples(got->data, want->data, want->frames * want->channels),
+                  what, threads);
+}
+
+// A copy of mono `ad` with `removed` samples at `at` replaced by `inserted` samples of something else.
+static Audiodata* verify_edit_audio(const Audiodata* ad, size_t at, size_t removed, size_t inserted) {
+    Audiodata* ret = calloc(1, sizeof(Audiodata));
+    assert(ret);
+    ret->sample_rate = ad->sample_rate;
+    ret->frames = ad->frames - removed + inserted;
+    ret->channels = 1;
+    ret->data = pool_alloc(ret->frames * sizeof(sample));
+
+    memcpy(ret->data, ad->data, at * sizeof(sample));
+    for (size_t i = 0; i < inserted; i++)
+        ret->data[at + i] = (sample)((i % 7) - 3) / 4;
+    memcpy(ret->data + at + inserted, ad->data + at + removed, (ad->frames - at - removed) * sizeof(sample));
+    return ret;
+}
+
+// Root mean square of `n` samples.
+static double verify_rms(const sample* x, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (double)x[i] * x[i];
+    return n > 0 ? sqrt(sum / n) : 0;
+}
+
+// The phase vocoder keeps a steady tone at its level all the way out to both ends of the output, stretching
+// and shifting either way. Frames that only partly cover the input would otherwise fade the first and last
+// window in and out. Not bit-exact, so it allows a tenth of a decibel.
+static void verify_stretch(Verifier* v) {
+    const size_t window_size = 4096, frames = 48000;
+    const double amplitude = 0.5;
+    const double settings[][2] = { { 1, 0 }, { 1.5, 0 }, { 0.7, 0 }, { 1, 4 }, { 1.3, -5 } };
+
+    Audiodata ad = { .sample_rate = 48000, .frames = frames, .channels = 1 };
+    ad.data = pool_alloc(frames * sizeof(sample));
+    for (size_t i = 0; i < frames; i++)
+        ad.data[i] = amplitude * sin(2 * M_PI * 440 * i / 48000);
+    ThreadPool* pool = threadpool_create(1);
+
+    for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+        const double stretch = settings[s][0], semitones = settings[s][1];
+        FFTKernel* fk = fftkernel_create(WF_HANN, window_size, stretch_default_hop(window_size, stretch, semitones));
+        v->fk = fk;
+
+        Audiodata* out = vocoder_stretch(fk, pool, &ad, stretch, semitones);
+        const double want = amplitude / sqrt(2);
+        double first = 0, last = 0;
+        if (out && out->frames >= window_size) {
+            first = verify_rms(out->data, window_size) / want;
+            last = verify_rms(out->data + out->frames - window_size, window_size) / want;
+        }
+
+        char what[160];
+        snprintf(what, sizeof(what), "vocoder_stretch by %g and %+g semitones, first window at %.3f and last at %.3f of the level",
+                 stretch, semitones, first, last);
+        verify_report(v, fabs(20 * log10(first)) < 0.1 && fabs(20 * log10(last)) < 0.1, what, 0);
+
+        if (out)
+            audiodata_destroy(out);
+        fftkernel_destroy(fk);
+    }
+
+    threadpool_destroy(pool);
+    pool_free(ad.data);
+}
+
+// The thread pool paths against the serial ones, for every channel of `am`.
+static void verify_parallel(Verifier* v, FFTKernel* fk, size_t threads, const Audiodata* ad, const AudiodataMany* am,
+                            Spectrodata** serial_sd, Audiodata** serial_ad) {
+    ThreadPool* pool = threadpool_create(threads);
+    fftkernel_reserve_workers(fk, threads);
+
+    Spectrodata* sd = fftkernel_execute_forward_parallel(fk, pool, &am->data[0]);
+    verify_bins(v, "fftkernel_execute_forward_parallel", threads, serial_sd[0], sd);
+    spectrodata_destroy(sd);
+
+    Audiodata* out = fftkernel_execute_reverse_parallel(fk, pool, serial_sd[0]);
+    verify_audio(v, "fftkernel_execute_reverse_parallel", threads, serial_ad[0], out);
+    audiodata_destroy(out);
+
+    SpectrodataMany* sm = fftkernel_execute_forward_many(fk, pool, am);
+    for (int c = 0; c < am->count; c++)
+        verify_bins(v, "fftkernel_execute_forward_many", threads, serial_sd[c], &sm->data[c]);
+
+    AudiodataMany* outs = fftkernel_execute_reverse_many(fk, pool, sm);
+    for (int c = 0; c < am->count; c++)
+        verify_audio(v, "fftkernel_execute_reverse_many", threads, serial_ad[c], &outs->data[c]);
+    audiodata_many_destroy(outs);
+    spectrodata_many_destroy(sm);
+
+    sm = fftkernel_execute_forward_interleaved(fk, pool, ad);
+    for (int c = 0; c < am->count; c++)
+        verify_bins(v, "fftkernel_execute_forward_interleaved", threads, serial_sd[c], &sm->data[c]);
+    spectrodata_many_destroy(sm);
+
+    threadpool_destroy(pool);
+}
+
+// The incremental paths against doing the whole thing again.
+static void verify_incremental(Verifier* v, const FFTKernel* fk, const Audiodata* ad, const Audiodata* serial_ad) {
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    // Two separate runs of edited windows, resynthesized with fftkernel_execute_reverse_dirty.
+    Spectrodata* sd = fftkernel_execute_forward(fk, ad);
+    Audiodata* out = verify_edit_audio(serial_ad, 0, 0, 0);
+    const size_t runs[2][2] = {
+        { sd->window_count / 5, MIN(sd->window_count / 5 + 3, sd->window_count) },
+        { sd->window_count / 2, MIN(sd->window_count / 2 + 1, sd->window_count) },
+    };
+    for (int r = 0; r < 2; r++) {
+        for (size_t i = runs[r][0] * spec_size; i < runs[r][1] * spec_size; i++) {
+            sd->data[i][0] *= (sample)0.5;
+            sd->data[i][1] = -sd->data[i][1];
+        }
+        spectrodata_mark_dirty(sd, runs[r][0], runs[r][1]);
+    }
+    fftkernel_execute_reverse_dirty(fk, sd, out);
+    Audiodata* full = fftkernel_execute_reverse(fk, sd);
+    verify_audio(v, "fftkernel_execute_reverse_dirty", 0, full, out);
+    audiodata_destroy(full);
+    audiodata_destroy(out);
+    spectrodata_destroy(sd);
+
+    // Samples overwritten in place, then inserted and removed by whole hops (moved windows) and by odd amounts.
+    const size_t at = ad->frames / 3;
+    const size_t edits[][3] = {
+        { at, 100, 100 },
+        { at, 0, 3 * fk->hop_size },
+        { at, 2 * fk->hop_size, 0 },
+        { at, 0, 17 },
+        { at, 1, 0 },
+        { 0, 0, fk->hop_size },
+    };
+    for (size_t e = 0; e < sizeof(edits) / sizeof(edits[0]); e++) {
+        const size_t removed = edits[e][1], inserted = edits[e][2];
+        // Too little audio for this kernel to remove that much.
+        if (edits[e][0] + removed > ad->frames)
+            continue;
+        Audiodata* edited = verify_edit_audio(ad, edits[e][0], removed, inserted);
+
+        sd = fftkernel_execute_forward(fk, ad);
+        if (removed == inserted) {
+            fftkernel_update_forward(fk, edited, sd, edits[e][0], edits[e][0] + inserted);
+        } else {
+            fftkernel_update_forward_resized(fk, edited, sd, edits[e][0], removed, inserted);
+        }
+        Spectrodata* fresh = fftkernel_execute_forward(fk, edited);
+        verify_bins(v, removed == inserted ? "fftkernel_update_forward" : "fftkernel_update_forward_resized", 0, fresh, sd);
+
+        spectrodata_destroy(fresh);
+        spectrodata_destroy(sd);
+        audiodata_destroy(edited);
+    }
+}
+
+// Phase reconstruction on a spectrogram that is already consistent, starting from its own phases, has nothing
+// left to fix. The spectral convergence has to get under the tolerance right away, so the first and last
+// window, where fewer frames overlap, have to resynthesize consistently too. Not bit-exact.
+// It runs on a few windows of its own noise rather than on SECONDS of it. The samples where the windows sum to
+// under the 1e-3 floor don't come back exactly, and in audio only a window or two long they are most of it.
+static void verify_phase(Verifier* v, FFTKernel* fk) {
+    Audiodata* ad = audiodata_create_noise(8 * fk->window_size + fk->hop_size / 2, 48000, 1);
+    ThreadPool* pool = threadpool_create(2);
+    fftkernel_reserve_workers(fk, pool->thread_count);
+
+    PhaseOptions opt = phase_defaults;
+    opt.max_iterations = 10;
+    opt.tolerance = 1e-4;
+    opt.random_phase = false;
+
+    Spectrodata* sd = fftkernel_execute_forward(fk, ad);
+    double convergence = 1;
+    const size_t iterations = fftkernel_reconstruct_phase(fk, pool, sd, &opt, &convergence);
+
+    char what[128];
+    snprintf(what, sizeof(what), "fftkernel_reconstruct_phase, spectral convergence %.2g after %zu iterations",
+             convergence, iterations);
+    verify_report(v, convergence < opt.tolerance, what, pool->thread_count);
+
+    spectrodata_destroy(sd);
+    threadpool_destroy(pool);
+    audiodata_destroy(ad);
+}
+
+static int cmd_verify(int argc, char** argv) {
+    double seconds = argc > 0 ? atof(argv[0]) : 1.0;
+    if (seconds <= 0) {
+        usage();
+        return 1;
+    }
+
+    Audiodata* ad = audiodata_create_noise((size_t)(seconds * 48000), 48000, 2);
+    AudiodataMany* am = audiodata_split_channels(ad);
+
+    // Hops that divide the window, equal it, leave a remainder, and skip samples.
+    const size_t shapes[][2] = { { 4096, 1024 }, { 1024, 256 }, { 512, 512 }, { 256, 100 }, { 256, 300 }, { 64, 16 } };
+    const size_t thread_counts[] = { 1, 2, 3, cpu_count() };
+
+    Verifier v = { 0 };
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        FFTKernel* fk = fftkernel_create(WF_HANN, shapes[s][0], shapes[s][1]);
+        v.fk = fk;
+
+        Spectrodata* serial_sd[2];
+        Audiodata* serial_ad[2];
+        for (int c = 0; c < 2; c++) {
+            serial_sd[c] = fftkernel_execute_forward(fk, &am->data[c]);
+            serial_ad[c] = fftkernel_execute_reverse(fk, serial_sd[c]);
+        }
+
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            if (t < 3 || thread_counts[t] > 3)
+                verify_parallel(&v, fk, thread_counts[t], ad, am, serial_sd, serial_ad);
+        }
+        verify_incremental(&v, fk, &am->data[0], serial_ad[0]);
+        verify_phase(&v, fk);
+
+        for (int c = 0; c < 2; c++) {
+            spectrodata_destroy(serial_sd[c]);
+            audiodata_destroy(serial_ad[c]);
+        }
+        fftkernel_destroy(fk);
+    }
+
+    verify_stretch(&v);
+
+    audiodata_many_destroy(am);
+    audiodata_destroy(ad);
+
+    printf("%zu checks, %zu mismatches\n", v.checks, v.mismatches);
+    return v.mismatches > 0 ? 1 : 0;
+}
+
+static int cmd_time_render(const CliOptions* opt, int argc, char** argv) {
+    size_t windows = argc > 0 ? strtoul(argv[0], NULL, 10) : 1000;
+    if (windows == 0) {
+        usage();
+        return 1;
+    }
+
+    const size_t window_size = 4096;
+    FFTKernel* fk = fftkernel_create(WF_HANN, window_size, window_size / 2);
+    Audiodata* ad = audiodata_create_noise(windows * (window_size / 2), 48000, 1);
+    Spectrodata* sd = fftkernel_execute_forward(fk, ad);
+    Colormap* cm = colormap_for(opt);
+    RenderOptions ropt = render_defaults;
+    ropt.colormap = cm;
+
+    // The first render allocates the image; the rest reuse it, like an editor redrawing.
+    Imagedata img = { 0 };
+    spectro_render_magnitude(fk, sd, &img, &ropt);
+    double best = 1e30;
+    for (int run = 0; run < 20; run++) {
+        double t0 = now_seconds();
+        spectro_render_magnitude(fk, sd, &img, &ropt);
+        double t = now_seconds() - t0;
+        if (t < best)
+            best = t;
+    }
+    printf("magnitude, %dx%d, %zu levels: %.2f ms (%.2f ns/bin)\n", img.width, img.height, cm->size,
+           best * 1e3, best * 1e9 / ((double)img.width * img.height));
+
+    ThreadPool* pool = threadpool_create(0);
+    ropt.phase_accuracy = opt->phase_accuracy;
+    best = 1e30;
+    for (int run = 0; run < 20; run++) {
+        double t0 = now_seconds();
+        spectro_render_domain_coloring(fk, pool, sd, &img, &ropt);
+        double t = now_seconds() - t0;
+        if (t < best)
+            best = t;
+    }
+    printf("domain coloring, %s phase, %zu threads: %.2f ms (%.2f ns/bin)\n",
+           opt->phase_accuracy == PHASE_FAST ? "fast" : "accurate", pool->thread_count,
+           best * 1e3, best * 1e9 / ((double)img.width * img.height));
+    threadpool_destroy(pool);
+
+    imagedata_clear(&img);
+    colormap_destroy(cm);
+    spectrodata_destroy(sd);
+    audiodata_destroy(ad);
+    fftkernel_destroy(fk);
+    return 0;
+}
+
+static int cmd_griffin_lim(const CliOptions* opt, int argc, char** argv) {
+    PhaseOptions popt = phase_defaults;
+    if (argc > 0)
+        popt.max_iterations = strtoul(argv[0], NULL, 10);
+    if (argc > 1)
+        popt.tolerance = strtod(argv[1], NULL);
+    if (!opt->input || !opt->output) {
+        usage();
+        return 1;
+    }
+
+    SpectroFileHeader header;
+    SpectrodataMany* sm = spectrodata_map_file(opt->input, false, &header);
+    if (!sm)
+        return 1;
+
+    FFTKernel* fk = fftkernel_create(header.window_type, header.window_size, header.hop_size);
+    if (!fk) {
+        spectrodata_many_destroy(sm);
+        return 1;
+    }
+    ThreadPool* pool = threadpool_create(0);
+    fftkernel_reserve_workers(fk, pool->thread_count);
+
+    AudiodataMany am = { .count = sm->count, .data = calloc(sm->count, sizeof(Audiodata)) };
+    assert(am.data);
+    Spectrodata sd = { 0 };
+    for (int c = 0; c < sm->count; c++) {
+        // Throw the phases away, as if the spectrogram had come from an image.
+        const Spectrodata* in = &sm->data[c];
+        spectrodata_init(&sd, fk, in->sample_rate, in->original_length);
+        for (size_t i = 0; i < in->window_count * (fk->window_size / 2 + 1); i++) {
+            sd.data[i][0] = sqrt(in->data[i][0] * in->data[i][0] + in->data[i][1] * in->data[i][1]);
+            sd.data[i][1] = 0;
+        }
+
+        const double t0 = now_seconds();
+        double convergence;
+        size_t iterations = fftkernel_reconstruct_phase(fk, pool, &sd, &popt, &convergence);
+        fprintf(stderr, "channel %d: %zu iterations in %.3f s, spectral convergence %.4f\n", c, iterations,
+                now_seconds() - t0, convergence);
+
+        fftkernel_execute_reverse_into(fk, &sd, &am.data[c]);
+    }
+
+    Audiodata* ad = audiodata_join_channels(&am);
+    audiodata_write_file(opt->output, ad);
+
+    audiodata_destroy(ad);
+    for (int c = 0; c < am.count; c++)
+        pool_free(am.data[c].data);
+    free(am.data);
+    spectrodata_free_bins(&sd);
+    threadpool_destroy(pool);
+    fftkernel_destroy(fk);
+    spectrodata_many_destroy(sm);
+    return 0;
+}
+
+static int cmd_stretch(const CliOptions* opt, bool hop_given, int argc, char** argv) {
+    const double stretch = argc > 0 ? strtod(argv[0], NULL) : 0;
+    const double semitones = argc > 1 ? strtod(argv[1], NULL) : 0;
+    if (!(stretch > 0) || !opt->input || !opt->output) {
+        usage();
+        return 1;
+    }
+
+    const size_t hop = hop_given ? opt->hop_size : stretch_default_hop(opt->window_size, stretch, semitones);
+
+    Audiodata* ad = audiodata_read_file(opt->input);
+    if (!ad)
+        return 1;
+
+    FFTKernel* fk = fftkernel_create(opt->window_function, opt->window_size, hop);
+    ThreadPool* pool = threadpool_create(0);
+
+    const double t0 = now_seconds();
+    Audiodata* out = vocoder_stretch(fk, pool, ad, stretch, semitones);
+    const double elapsed = now_seconds() - t0;
+
+    if (out) {
+        fprintf(stderr, "%zu frames to %zu in %.3f s (%.1fx real time)\n", ad->frames, out->frames, elapsed,
+                (double)ad->frames / ad->sample_rate / elapsed);
+        audiodata_write_file(opt->output, out);
+        audiodata_destroy(out);
+    }
+
+    threadpool_destroy(pool);
+    fftkernel_destroy(fk);
+    audiodata_destroy(ad);
+    return out ? 0 : 1;
+}
+
+// A stand-in for a live input: plays a file into a LiveAnalyzer from its own thread, in blocks of varying size.
+// A real input would drop what doesn't fit in the ring; this waits for room instead, so the result can be
+// checked against audio_to_spectro.
+typedef struct {
+    SNDFILE* sndfile;
+    int channels;
+    int sample_rate;
+    LiveAnalyzer* la;
+    sample* block;
+    size_t max_block;
+
+    // Push no faster than the sample rate, like a sound card would.
+    bool paced;
+} LiveFileSource;
+
+static void* live_file_source_main(void* arg) {
+    LiveFileSource* src = arg;
+    const double t0 = now_seconds();
+    size_t pushed = 0;
+    uint32_t state = 0x2545F491;
+
+    for (;;) {
+        state = state * 1664525u + 1013904223u;
+        const size_t want = 1 + (state >> 8) % src->max_block;
+        const sf_count_t got = sf_readf_sample(src->sndfile, src->block, want, src->channels);
+        if (got <= 0)
+            break;
+
+        if (src->paced) {
+            const double due = t0 + (double)pushed / src->sample_rate;
+            const double now = now_seconds();
+            if (due > now)
+                sleep_seconds(due - now);
+        }
+        while (live_analyzer_space(src->la) < (size_t)got)
+            sched_yield();
+        live_analyzer_push(src->la, src->block, got);
+        pushed += got;
+    }
+
+    live_analyzer_finish(src->la);
+    return NULL;
+}
+
+static int cmd_live(const CliOptions* opt, int argc, char** argv) {
+    size_t max_block = argc > 0 ? strtoul(argv[0], NULL, 10) : 512;
+    bool paced = argc > 1 && !strcmp(argv[1], "paced");
+    if (max_block == 0 || !opt->input || !opt->output || (argc > 1 && !paced)) {
+        usage();
+        return 1;
+    }
+
+    SF_INFO sfinfo = {};
+    SNDFILE* sndfile = sf_open(opt->input, SFM_READ, &sfinfo);
+    if (!sndfile) {
+        fprintf(stderr, "Error opening audio file '%s': %s\n", opt->input, sf_strerror(NULL));
+        return 1;
+    }
+
+    FFTKernel* fk = fftkernel_create(opt->window_function, opt->window_size, opt->hop_size);
+    LiveAnalyzer* la = live_analyzer_create(fk, sfinfo.channels, max_block);
+    assert(la);
+    const size_t spec_size = fk->window_size / 2 + 1;
+
+    // Everything the two threads need is allocated up front.
+    SpectrodataMany* sm = calloc(1, sizeof(SpectrodataMany));
+    assert(sm);
+    sm->count = sfinfo.channels;
+    sm->data = calloc(sfinfo.channels, sizeof(Spectrodata));
+    assert(sm->data);
+    for (int c = 0; c < sfinfo.channels; c++)
+        spectrodata_init(&sm->data[c], fk, sfinfo.samplerate, sfinfo.frames);
+    FFTW(complex)* bins = FFTW(malloc)(sfinfo.channels * spec_size * sizeof(FFTW(complex)));
+    assert(bins);
+
+    LiveFileSource src = {
+        .sndfile = sndfile,
+        .channels = sfinfo.channels,
+        .sample_rate = sfinfo.samplerate,
+        .la = la,
+        .block = malloc(max_block * sfinfo.channels * sizeof(sample)),
+        .max_block = max_block,
+        .paced = paced,
+    };
+    assert(src.block);
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, live_file_source_main, &src);
+    assert(err == 0);
+    (void)err;
+
+    const double t0 = now_seconds();
+    for (;;) {
+        // Checked before polling: if the input had already finished, a miss means every window is out.
+        const bool finished = atomic_load_explicit(&la->finished, memory_order_acquire);
+        if (live_analyzer_poll(la, bins)) {
+            const size_t w = la->windows_emitted - 1;
+            for (int c = 0; c < sm->count && w < sm->data[c].window_count; c++)
+                memcpy(sm->data[c].data + w * spec_size, bins + c * spec_size, spec_size * sizeof(FFTW(complex)));
+            continue;
+        }
+        if (finished)
+            break;
+        sched_yield();
+    }
+    const double elapsed = now_seconds() - t0;
+    pthread_join(thread, NULL);
+
+    fprintf(stderr, "%zu windows in %.3f s, %zu frames dropped, worst lag %zu frames; latency at most %.2f ms\n",
+            la->windows_emitted, elapsed, atomic_load(&la->dropped), la->max_lag,
+            (fk->window_size + la->max_lag) * 1e3 / sfinfo.samplerate);
+
+    bool ok = spectrodata_write_file(opt->output, fk, sm);
+
+    free(src.block);
+    sf_close(sndfile);
+    FFTW(free)(bins);
+    spectrodata_many_destroy(sm);
+    live_analyzer_destroy(la);
+    fftkernel_destroy(fk);
+    return ok ? 0 : 1;
+}
+
+// Batches.
+// A manifest lists one conversion per line, `INPUT OUTPUT` or `FUNCTION INPUT OUTPUT`, separated by tabs if
+// the line has any and by spaces otherwise; the function defaults to audio_to_spectro. Blank lines and lines
+// starting with # are skipped. Lines run side by side, so none may read another's output.
+// Every file runs on one worker of a pool, and each worker keeps a ConvertContext for the whole batch, so
+// kernels are planned once per worker rather than once per file. Workers take the next file as soon as they
+// finish one, and the biggest files go first, so a long file doesn't start last and leave everyone else idle.
+typedef struct {
+    const char* function;
+    char* input;
+    char* output;
+    size_t line;
+
+    // Size of the input, which stands in for how long it will take.
+    size_t bytes;
+
+    Conversion run;
+    int status;
+    double seconds;
+} BatchJob;
+
+typedef struct {
+    const CliOptions* opt;
+    BatchJob** order;
+    ConvertContext* contexts;
+} Batch;
+
+// Splits `line` in place into at most `max` fields. Returns how many there were, or max + 1 if too many.
+static size_t split_fields(char* line, char** fields, size_t max) {
+    const char* seps = strchr(line, '\t') ? "\t" : " ";
+    size_t count = 0;
+    for (char* field = strtok(line, seps); field; field = strtok(NULL, seps)) {
+        if (count == max)
+            return max + 1;
+        fields[count++] = field;
+    }
+    return count;
+}
+
+// Check return value. Reads the manifest into `*jobs`; every function in it is known.
+static size_t batch_read_manifest(const char* fname, BatchJob** jobs) {
+    FILE* f = fopen(fname, "r");
+    if (!f) {
+        fprintf(stderr, "Couldn't open manifest '%s'.\n", fname);
+        return 0;
+    }
+
+    size_t count = 0, capacity = 0;
+    *jobs = NULL;
+    char line[4096];
+    bool ok = true;
+    for (size_t number = 1; ok && fgets(line, sizeof(line), f); number++) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+            continue;
+
+        char* fields[3];
+        const size_t n = split_fields(line, fields, 3);
+        BatchJob job = { .function = "audio_to_spectro", .line = number };
+        if (n == 2 || n == 3) {
+            if (n == 3)
+                job.function = fields[0];
+            job.input = fields[n - 2];
+            job.output = fields[n - 1];
+        }
+
+        if (n != 2 && n != 3) {
+            fprintf(stderr, "%s:%zu: Expected INPUT OUTPUT or FUNCTION INPUT OUTPUT.\n", fname, number);
+            ok = false;
+        } else if (!(job.function = conversion_named(job.function, &job.run))) {
+            fprintf(stderr, "%s:%zu: Unknown function '%s'.\n", fname, number, fields[0]);
+            ok = false;
+        } else {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                *jobs = realloc(*jobs, capacity * sizeof(BatchJob));
+                assert(*jobs);
+            }
+            job.input = strdup(job.input);
+            job.output = strdup(job.output);
+            assert(job.input && job.output);
+
+            struct stat st;
+            job.bytes = stat(job.input, &st) == 0 ? (size_t)st.st_size : 0;
+            (*jobs)[count++] = job;
+        }
+    }
+    fclose(f);
+
+    if (ok && count == 0)
+        fprintf(stderr, "Manifest '%s' has no files in it.\n", fname);
+    if (!ok || count == 0) {
+        for (size_t i = 0; i < count; i++) {
+            free((*jobs)[i].input);
+            free((*jobs)[i].output);
+        }
+        free(*jobs);
+        *jobs = NULL;
+        return 0;
+    }
+    return count;
+}
+
+static int batch_job_bigger(const void* a, const void* b) {
+    const BatchJob* x = *(BatchJob* const*)a;
+    const BatchJob* y = *(BatchJob* const*)b;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+    return x->line < y->line ? -1 : 1;
+}
+
+static void batch_task(void* ctx, size_t task, size_t worker) {
+    const Batch* batch = ctx;
+    BatchJob* job = batch->order[task];
+
+    CliOptions opt = *batch->opt;
+    opt.function = job->function;
+    opt.input = job->input;
+    opt.output = job->output;
+    opt.stage_times = false;
+
+    TRACE_SCOPE(job->function);
+    const double t0 = now_seconds();
+    job->status = job->run(&opt, &batch->contexts[worker]);
+    job->seconds = now_seconds() - t0;
+}
+
+// `batch MANIFEST [THREADS]`: runs every conversion in the manifest and reports how long each took, in
+// manifest order, then the totals. The analysis options apply to every audio_to_spectro in it.
+static int cmd_batch(const CliOptions* opt, int argc, char** argv) {
+    if (argc < 1) {
+        usage();
+        return 1;
+    }
+    const size_t threads = argc >= 2 ? strtoul(argv[1], NULL, 10) : 0;
+
+    BatchJob* jobs;
+    const size_t count = batch_read_manifest(argv[0], &jobs);
+    if (count == 0)
+        return 1;
+
+    BatchJob** order = malloc(count * sizeof(BatchJob*));
+    assert(order);
+    for (size_t i = 0; i < count; i++)
+        order[i] = &jobs[i];
+    qsort(order, count, sizeof(BatchJob*), batch_job_bigger);
+
+    // Files run side by side, so each one gets a single worker of its own rather than a pool.
+    ThreadPool* pool = threadpool_create(threads);
+    Batch batch = {
+        .opt = opt,
+        .order = order,
+        .contexts = calloc(pool->thread_count, sizeof(ConvertContext)),
+    };
+    assert(batch.contexts);
+    for (size_t i = 0; i < pool->thread_count; i++)
+        batch.contexts[i].pool_threads = 1;
+
+    const double t0 = now_seconds();
+    threadpool_run(pool, batch_task, &batch, count);
+    const double wall = now_seconds() - t0;
+
+    size_t failed = 0, bytes = 0;
+    double busy = 0;
+    for (size_t i = 0; i < count; i++) {
+        const BatchJob* job = &jobs[i];
+        printf("%10.3f s  %s  %s -> %s%s\n", job->seconds, job->function, job->input, job->output,
+               job->status ? "  FAILED" : "");
+        failed += job->status != 0;
+        bytes += job->bytes;
+        busy += job->seconds;
+    }
+    printf("%zu files, %zu failed, %zu workers, %.3f s: %.1f files/s, %.1f MiB/s in, %.0f%% busy\n",
+           count, failed, pool->thread_count, wall, count / wall, bytes / 1048576.0 / wall,
+           100 * busy / (wall * pool->thread_count));
+
+    for (size_t i = 0; i < pool->thread_count; i++)
+        convert_context_clear(&batch.contexts[i]);
+    free(batch.contexts);
+    threadpool_destroy(pool);
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].input);
+        free(jobs[i].output);
+    }
+    free(order);
+    free(jobs);
+    return failed ? 1 : 0;
+}
+
+// Benchmarks.
+// `bench` sweeps the kernels over synthetic noise and prints one JSON document, so runs on different commits
+// can be diffed or plotted. Every timing is the best of a few runs.
+//
+// Peak RSS only ever goes up, so a process-wide figure would mostly say how big the biggest case so far was.
+// On POSIX each case runs in a forked child, and reports the child's own peak. Windows has no fork, so there
+// it reports how far the case pushed the process peak past where it was when the case started, which is zero
+// for a case smaller than an earlier one. "rss_mode" in the output says which.
+#ifdef _WIN32
+#define BENCH_RSS_MODE "process_peak_growth"
+#else
+#define BENCH_RSS_MODE "forked_child_peak"
+#endif
+
+static size_t peak_rss_bytes(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+typedef struct {
+    FILE* out;
+    bool first;
+    // Subtracted from peak_rss_bytes for the results; see BENCH_RSS_MODE.
+    size_t rss_base;
+} BenchReport;
+
+typedef struct {
+    size_t window_size;
+    size_t hop_size;
+    int channels;
+    size_t frames;
+} BenchCase;
+
+#define BENCH_RUNS 3
+#define BENCH_SAMPLE_RATE 48000
+
+// One result object. `windows` and `bins` are per run; zero leaves the rate out.
+static void bench_emit(BenchReport* r, const char* op, const BenchCase* c, double seconds, size_t samples, size_t windows, size_t bins) {
+    fprintf(r->out, "%s\n    {\"op\": \"%s\", \"window\": %zu, \"hop\": %zu, \"channels\": %d, \"frames\": %zu, \"time_s\": %.9f",
+            r->first ? "" : ",", op, c->window_size, c->hop_size, c->channels, c->frames, seconds);
+    if (samples)
+        fprintf(r->out, ", \"samples_per_s\": %.1f", samples / seconds);
+    if (windows)
+        fprintf(r->out, ", \"windows_per_s\": %.1f", windows / seconds);
+    if (bins)
+        fprintf(r->out, ", \"ns_per_bin\": %.4f", seconds * 1e9 / bins);
+    const size_t peak = peak_rss_bytes();
+    fprintf(r->out, ", \"peak_rss_bytes\": %zu}", peak > r->rss_base ? peak - r->rss_base : 0);
+    r->first = false;
+}
+
+static void bench_case(BenchReport* r, const BenchCase* c) {
+    const size_t spec_size = c->window_size / 2 + 1;
+
+    double t0 = now_seconds();
+    FFTKernel* fk = fftkernel_create(WF_HANN, c->window_size, c->hop_size);
+    bench_emit(r, "fftkernel_create", c, now_seconds() - t0, 0, 0, 0);
+
+    Audiodata* ad = audiodata_create_noise(c->frames, BENCH_SAMPLE_RATE, c->channels);
+    const size_t samples = c->frames * c->channels;
+
+    double best = 1e30;
+    AudiodataMany* am = NULL;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        if (am)
+            audiodata_many_destroy(am);
+        t0 = now_seconds();
+        am = audiodata_split_channels(ad);
+        best = MIN(best, now_seconds() - t0);
+    }
+    bench_emit(r, "audiodata_split_channels", c, best, samples, 0, 0);
+
+    // The _into variants keep allocation out of the timings after the first run.
+    Spectrodata* sds = calloc(c->channels, sizeof(Spectrodata));
+    Audiodata* outs = calloc(c->channels, sizeof(Audiodata));
+    assert(sds && outs);
+
+    best = 1e30;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        t0 = now_seconds();
+        for (int ch = 0; ch < c->channels; ch++)
+            fftkernel_execute_forward_into(fk, &am->data[ch], &sds[ch]);
+        best = MIN(best, now_seconds() - t0);
+    }
+    const size_t windows = sds[0].window_count * c->channels;
+    bench_emit(r, "fftkernel_execute_forward", c, best, samples, windows, windows * spec_size);
+
+    best = 1e30;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        t0 = now_seconds();
+        for (int ch = 0; ch < c->channels; ch++)
+            fftkernel_execute_reverse_into(fk, &sds[ch], &outs[ch]);
+        best = MIN(best, now_seconds() - t0);
+    }
+    bench_emit(r, "fftkernel_execute_reverse", c, best, samples, windows, windows * spec_size);
+
+    // Drawing is per channel, so only the first one is timed.
+    Imagedata img = { 0 };
+    best = 1e30;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        t0 = now_seconds();
+        spectro_render_magnitude(fk, &sds[0], &img, NULL);
+        best = MIN(best, now_seconds() - t0);
+    }
+    bench_emit(r, "spectro_render_magnitude", c, best, 0, sds[0].window_count, sds[0].window_count * spec_size);
+    imagedata_clear(&img);
+
+    for (int ch = 0; ch < c->channels; ch++) {
+        spectrodata_free_bins(&sds[ch]);
+        spectrodata_clear_dirty(&sds[ch]);
+        pool_free(outs[ch].data);
+    }
+    free(sds);
+    free(outs);
+    audiodata_many_destroy(am);
+    audiodata_destroy(ad);
+    fftkernel_destroy(fk);
+}
+
+// Runs one case the way BENCH_RSS_MODE says. Check return value.
+static bool bench_run_case(BenchReport* r, const BenchCase* c) {
+#ifdef _WIN32
+    r->rss_base = peak_rss_bytes();
+    bench_case(r, c);
+    return true;
+#else
+    // The child writes through its copy of `out`, so nothing of ours may still be sitting in the buffer.
+    fflush(r->out);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "bench: Couldn't fork for the case.\n");
+        return false;
+    }
+    if (pid == 0) {
+        bench_case(r, c);
+        fflush(r->out);
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench: The case didn't finish.\n");
+        return false;
+    }
+    r->first = false;
+    return true;
+#endif
+}
+
+static int cmd_bench(const CliOptions* opt, int argc, char** argv) {
+    static const size_t full_windows[] = { 256, 1024, 4096, 16384 };
+    static const size_t quick_windows[] = { 1024, 4096 };
+    static const size_t full_hop_divisors[] = { 2, 4 };
+    static const int full_channels[] = { 1, 2, 8 };
+    static const double full_seconds[] = { 1, 10 };
+
+    const bool quick = argc > 0 && !strcmp(argv[0], "quick");
+    if (argc > 1 || (argc == 1 && !quick)) {
+        usage();
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (opt->output) {
+        out = fopen(opt->output, "w");
+        if (!out) {
+            fprintf(stderr, "Failed to open '%s' for writing.\n", opt->output);
+            return 1;
+        }
+    }
+
+    char cpu[128];
+    wisdom_cpu_name(cpu, sizeof(cpu));
+    fprintf(out, "{\n  \"cpu\": \"%s\",\n  \"precision\": \"%s\",\n  \"threads\": %zu,\n  \"sample_rate\": %d,\n  \"rss_mode\": \"%s\",\n  \"results\": [",
+            cpu, SAMPLE_NAME, cpu_count(), BENCH_SAMPLE_RATE, BENCH_RSS_MODE);
+
+    BenchReport report = { .out = out, .first = true };
+    const size_t* windows = quick ? quick_windows : full_windows;
+    const size_t window_count = quick ? sizeof(quick_windows) / sizeof(*quick_windows) : sizeof(full_windows) / sizeof(*full_windows);
+
+    // Plan every size here, so the cases find the plans in wisdom; whatever a forked case plans dies with it.
+    for (size_t w = 0; w < window_count; w++)
+        fftkernel_destroy(fftkernel_create(WF_HANN, windows[w], windows[w] / 2));
+
+    bool ok = true;
+    for (size_t w = 0; w < window_count && ok; w++) {
+        for (size_t h = 0; h < (quick ? 1 : 2) && ok; h++) {
+            for (size_t c = 0; c < sizeof(full_channels) / sizeof(*full_channels) && ok; c++) {
+                for (size_t l = 0; l < (quick ? 1 : 2) && ok; l++) {
+                    const BenchCase bc = {
+                        .window_size = windows[w],
+                        .hop_size = windows[w] / full_hop_divisors[h],
+                        .channels = full_channels[c],
+                        .frames = (size_t)(full_seconds[l] * BENCH_SAMPLE_RATE),
+                    };
+                    fprintf(stderr, "bench: window %zu, hop %zu, %d channels, %zu frames\n",
+                            bc.window_size, bc.hop_size, bc.channels, bc.frames);
+                    ok = bench_run_case(&report, &bc);
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n  ],\n  \"peak_rss_bytes\": %zu\n}\n", peak_rss_bytes());
+    if (out != stdout)
+        fclose(out);
+    return ok ? 0 : 1;
+}
+
+static void print_pool_stats(void) {
+    const BufferPoolStats stats = buffer_pool_stats();
+    fprintf(stderr, "buffer pool: %zu hits, %zu misses, %.1f MiB peak, %.1f MiB cached\n", stats.hits, stats.misses,
+            stats.peak_bytes / 1048576.0, stats.cached_bytes / 1048576.0);
+}
+
+// Reads a size option, or returns 0 if it isn't one.
+static size_t parse_size(const char* arg) {
+    char* end;
+    unsigned long n = strtoul(arg, &end, 10);
+    return *end ? 0 : n;
+}
+
+int main(int argc, char** argv) {
+    const char* wisdom_path = NULL;
+    bool fast_plan = false;
+    CliOptions opt = {
+        .window_function = WF_HANN,
+        .window_size = 4096,
+        .levels = 256,
+        .bands = 128,
+    };
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--fast-plan")) {
+            fast_plan = true;
+            continue;
+        }
+        if (!strcmp(arg, "--pool-stats")) {
+            atexit(print_pool_stats);
+            continue;
+        }
+        if (!strcmp(arg, "--stage-times")) {
+            opt.stage_times = true;
+            continue;
+        }
+        if (!value) {
+            usage();
+            return 1;
+        }
+        i++;
+
+        if (!strcmp(arg, "--wisdom")) {
+            wisdom_path = value;
+        } else if (!strcmp(arg, "--trace")) {
+#ifdef FOURIEDIT_TRACE
+            trace_start(value);
+#else
+            fprintf(stderr, "Built without FOURIEDIT_TRACE; --trace does nothing.\n");
+#endif
+        } else if (!strcmp(arg, "-f")) {
+            opt.function = value;
+        } else if (!strcmp(arg, "-i")) {
+            opt.input = value;
+        } else if (!strcmp(arg, "-o")) {
+            opt.output = value;
+        } else if (!strcmp(arg, "--window") && parse_size(value) >= 2) {
+            opt.window_size = parse_size(value);
+        } else if (!strcmp(arg, "--hop") && parse_size(value) > 0) {
+            opt.hop_size = parse_size(value);
+        } else if (!strcmp(arg, "--window-function") && (!strcmp(value, "hann") || !strcmp(value, "none"))) {
+            opt.window_function = !strcmp(value, "hann") ? WF_HANN : WF_NONE;
+        } else if (!strcmp(arg, "--colormap") && (!strcmp(value, "gray") || !strcmp(value, "heat"))) {
+            opt.colormap = value;
+        } else if (!strcmp(arg, "--levels") && parse_size(value) >= 2 && parse_size(value) <= 65536) {
+            opt.levels = parse_size(value);
+        } else if (!strcmp(arg, "--phase") && (!strcmp(value, "fast") || !strcmp(value, "accurate"))) {
+            opt.phase_accuracy = !strcmp(value, "fast") ? PHASE_FAST : PHASE_ACCURATE;
+        } else if (!strcmp(arg, "--bands") && parse_size(value) > 0 && parse_size(value) <= 4096) {
+            opt.bands = parse_size(value);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    const bool hop_given = opt.hop_size != 0;
+    if (!hop_given)
+        opt.hop_size = opt.window_size / 2;
+
+    if (opt.function) {
+        wisdom_configure(wisdom_path, !fast_plan);
+        return cmd_convert(&opt);
+    }
+    if (i >= argc) {
+        usage();
+        return 1;
+    }
+
+    const char* cmd = argv[i++];
+    if (!strcmp(cmd, "wisdom")) {
+        // Pre-warming is the whole point here, so never fall back to estimating.
+        wisdom_configure(wisdom_path, true);
+        return cmd_wisdom(argc - i, argv + i);
+    }
+
+    wisdom_configure(wisdom_path, !fast_plan);
+    if (!strcmp(cmd, "compare-engines"))
+        return cmd_compare_engines(argc - i, argv + i);
+    if (!strcmp(cmd, "verify"))
+        return cmd_verify(argc - i, argv + i);
+    if (!strcmp(cmd, "bench"))
+        return cmd_bench(&opt, argc - i, argv + i);
+    if (!strcmp(cmd, "time-render"))
+        return cmd_time_render(&opt, argc - i, argv + i);
+    if (!strcmp(cmd, "live"))
+        return cmd_live(&opt, argc - i, argv + i);
+    if (!strcmp(cmd, "griffin-lim"))
+        return cmd_griffin_lim(&opt, argc - i, argv + i);
+    if (!strcmp(cmd, "stretch"))
+        return cmd_stretch(&opt, hop_given, argc - i, argv + i);
+    if (!strcmp(cmd, "batch"))
+        return cmd_batch(&opt, argc - i, argv + i);
+
+    fprintf(stderr, "Unknown command '%s'.\n", cmd);
+    usage();
+    return 1;
+}
+#endif
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// The buffer pool and the typed buffers on top of it; see pool.h.
+#define POOL_ALIGN 64
+#define POOL_CLASSES 256
+
+typedef struct PoolBlock {
+    size_t size_class;
+    struct PoolBlock* next;
+} PoolBlock;
+
+// The header sits in the 64 bytes before the block, so the block stays aligned.
+_Static_assert(sizeof(PoolBlock) <= POOL_ALIGN, "PoolBlock must fit in the alignment padding");
+
+static struct {
+    pthread_mutex_t lock;
+    PoolBlock* free_lists[POOL_CLASSES];
+    BufferPoolStats stats;
+
+    // Blocks that would take cached_bytes over this are given back to the system instead.
+    size_t cache_limit;
+} buffer_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cache_limit = (size_t)1 << 30,
+};
+
+static size_t pool_class_of(size_t bytes) {
+    if (bytes <= POOL_ALIGN)
+        return 0;
+    // Classes are (4 + sub) << (k - 2), for the k with 2^k < bytes <= 2^(k+1).
+    const size_t n = bytes - 1;
+    int k = 63 - __builtin_clzll((unsigned long long)n);
+    const size_t sub = (n >> (k - 2)) & 3;
+    return (size_t)(k - 6) * 4 + sub + 1;
+}
+
+static size_t pool_class_size(size_t size_class) {
+    if (size_class == 0)
+        return POOL_ALIGN;
+    const int k = (int)(size_class - 1) / 4 + 6;
+    const size_t sub = (size_class - 1) % 4;
+    return (4 + sub + 1) << (k - 2);
+}
+
+static PoolBlock* pool_header(void* ptr) {
+    return (PoolBlock*)((char*)ptr - POOL_ALIGN);
+}
+
+static void* pool_system_alloc(size_t bytes) {
+#ifdef _WIN32
+    return _aligned_malloc(bytes, POOL_ALIGN);
+#else
+    void* ptr;
+    return posix_memalign(&ptr, POOL_ALIGN, bytes) == 0 ? ptr : NULL;
+#endif
+}
+
+static void pool_system_free(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// pool_alloc, but NULL when `bytes` is more than could ever be allocated or the system is out of memory.
+static void* pool_try_alloc(size_t bytes) {
+    if (bytes > PTRDIFF_MAX)
+        return NULL;
+    const size_t size_class = pool_class_of(bytes);
+    assert(size_class < POOL_CLASSES);
+    const size_t size = pool_class_size(size_class);
+
+    pthread_mutex_lock(&buffer_pool.lock);
+    BufferPoolStats* stats = &buffer_pool.stats;
+    PoolBlock* block = buffer_pool.free_lists[size_class];
+    if (block) {
+        buffer_pool.free_lists[size_class] = block->next;
+        stats->cached_bytes -= size;
+        stats->hits++;
+    } else {
+        stats->misses++;
+    }
+    stats->live_bytes += size;
+    if (stats->live_bytes + stats->cached_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes + stats->cached_bytes;
+    pthread_mutex_unlock(&buffer_pool.lock);
+
+    if (!block) {
+        block = pool_system_alloc(POOL_ALIGN + size);
+        if (!block) {
+            pthread_mutex_lock(&buffer_pool.lock);
+            stats->live_bytes -= size;
+            pthread_mutex_unlock(&buffer_pool.lock);
+            return NULL;
+        }
+        block->size_class = size_class;
+    }
+    block->next = NULL;
+    return (char*)block + POOL_ALIGN;
+}
+
+void* pool_alloc(size_t bytes) {
+    void* ptr = pool_try_alloc(bytes);
+    assert(ptr);
+    return ptr;
+}
+
+void* pool_calloc(size_t count, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes))
+        return NULL;
+
+    void* ptr = pool_try_alloc(bytes);
+    if (ptr)
+        memset(ptr, 0, bytes);
+    return ptr;
+}
+
+size_t pool_capacity(const void* ptr) {
+    return pool_class_size(pool_header((void*)ptr)->size_class);
+}
+
+void pool_free(void* ptr) {
+    if (!ptr)
+        return;
+
+    PoolBlock* block = pool_header(ptr);
+    const size_t size = pool_class_size(block->size_class);
+
+    pthread_mutex_lock(&buffer_pool.lock);
+    BufferPoolStats* stats = &buffer_pool.stats;
+    stats->live_bytes -= size;
+    const bool keep = stats->cached_bytes + size <= buffer_pool.cache_limit;
+    if (keep) {
+        block->next = buffer_pool.free_lists[block->size_class];
+        buffer_pool.free_lists[block->size_class] = block;
+        stats->cached_bytes += size;
+    }
+    pthread_mutex_unlock(&buffer_pool.lock);
+
+    if (!keep)
+        pool_system_free(block);
+}
+
+void pool_reserve(void** ptr, size_t bytes) {
+    if (*ptr && pool_capacity(*ptr) >= bytes)
+        return;
+    pool_free(*ptr);
+    *ptr = pool_alloc(bytes);
+}
+
+void buffer_pool_trim(void) {
+    pthread_mutex_lock(&buffer_pool.lock);
+    for (size_t c = 0; c < POOL_CLASSES; c++) {
+        while (buffer_pool.free_lists[c]) {
+            PoolBlock* block = buffer_pool.free_lists[c];
+            buffer_pool.free_lists[c] = block->next;
+            pool_system_free(block);
+        }
+    }
+    buffer_pool.stats.cached_bytes = 0;
+    pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+BufferPoolStats buffer_pool_stats(void) {
+    pthread_mutex_lock(&buffer_pool.lock);
+    BufferPoolStats stats = buffer_pool.stats;
+    pthread_mutex_unlock(&buffer_pool.lock);
+    return stats;
+}
+
+static void buf_resize(void** data, size_t* size, size_t new_size, size_t element_size, bool hard) {
+    const size_t bytes = new_size * element_size;
+    const size_t capacity = *data ? pool_capacity(*data) : 0;
+    const bool fits = *data && capacity >= bytes;
+    const bool too_big = *data && pool_class_of(bytes) < pool_header(*data)->size_class;
+
+    if (!fits || (hard && too_big)) {
+        void* block = pool_alloc(bytes);
+        if (*data) {
+            const size_t keep = *size * element_size;
+            memcpy(block, *data, keep < bytes ? keep : bytes);
+            pool_free(*data);
+        }
+        *data = block;
+    }
+    *size = new_size;
+}
+
+#define BUFFER_FUNCTIONS(name)                                                      \
+    void buf_resize_soft_##name(Buffer_##name* b, size_t size) {                    \
+        buf_resize((void**)&b->data, &b->size, size, sizeof(*b->data), false);      \
+    }                                                                               \
+    void buf_resize_hard_##name(Buffer_##name* b, size_t size) {                    \
+        buf_resize((void**)&b->data, &b->size, size, sizeof(*b->data), true);       \
+    }                                                                               \
+    void buf_free_##name(Buffer_##name* b) {                                        \
+        pool_free(b->data);                                                         \
+        b->data = NULL;                                                             \
+        b->size = 0;                                                                \
+    }
+
+BUFFER_FUNCTIONS(sample)
+BUFFER_FUNCTIONS(complex)
+BUFFER_FUNCTIONS(byte)
@@ -0,0 +1,76 @@
+#ifndef FOURIEDIT_POOL_H
+#define FOURIEDIT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "typename.h"
+
+// Buffer pool.
+// Sample and bin buffers come from here instead of straight from the system. Freed blocks are kept on a free
+// list per size class and handed out again, so a session doing the same conversions over and over stops
+// allocating after the first one. There are four classes per power of two, so a block is at most 25% bigger
+// than asked for. Blocks are 64-byte aligned, which is enough for any FFTW SIMD plan, but they must go back
+// through pool_free, never free or FFTW's free.
+typedef struct {
+    // Allocations served from a free list, and ones that had to go to the system.
+    size_t hits;
+    size_t misses;
+
+    // Handed out and not yet freed, kept on free lists, and the most the two together have ever been.
+    size_t live_bytes;
+    size_t cached_bytes;
+    size_t peak_bytes;
+} BufferPoolStats;
+
+// A block of at least `bytes` bytes, uninitialized. Never NULL, even for 0 bytes.
+void* pool_alloc(size_t bytes);
+
+// pool_alloc, zeroed. Like calloc, returns NULL if count * size overflows or can't be allocated, so sizes that
+// come from a file can be passed straight in.
+void* pool_calloc(size_t count, size_t size);
+
+// How many bytes a block from pool_alloc can actually hold.
+size_t pool_capacity(const void* ptr);
+
+// Ignores NULL, like free.
+void pool_free(void* ptr);
+
+// Makes *ptr hold at least `bytes` bytes, reusing the block it has if it is big enough. The contents are lost.
+void pool_reserve(void** ptr, size_t bytes);
+
+// Gives every cached block back to the system.
+void buffer_pool_trim(void);
+
+BufferPoolStats buffer_pool_stats(void);
+
+// Typed buffers on top of the pool, for code that keeps a buffer and resizes it as it goes. `size` is in
+// elements. A soft resize only ever grows the block and keeps the contents; a hard resize makes the block
+// fit the new size, shrinking it if that saves a size class, and keeps the contents that still fit.
+typedef struct {
+    sample* data;
+    size_t size;
+} Buffer_sample;
+
+typedef struct {
+    FFTW(complex)* data;
+    size_t size;
+} Buffer_complex;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+} Buffer_byte;
+
+void buf_resize_soft_sample(Buffer_sample* b, size_t size);
+void buf_resize_hard_sample(Buffer_sample* b, size_t size);
+void buf_free_sample(Buffer_sample* b);
+
+void buf_resize_soft_complex(Buffer_complex* b, size_t size);
+void buf_resize_hard_complex(Buffer_complex* b, size_t size);
+void buf_free_complex(Buffer_complex* b);
+
+void buf_resize_soft_byte(Buffer_byte* b, size_t size);
+void buf_resize_hard_byte(Buffer_byte* b, size_t size);
+void buf_free_byte(Buffer_byte* b);
+
+#endif
@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pyramid.h"
+#include "trace.h"
+
+// Tile pyramid.
+// For zooming out, magnitudes are pooled into tiles of TILE_SIZE x TILE_SIZE cells at every power-of-two
+// decimation. Time and frequency are decimated separately, since zooming out on a long file mostly squeezes
+// time: level (lt, lf) has one cell per 2^lt windows and 2^lf bins. Tiles are built on first use from the two
+// tiles below them, cached, and can be invalidated when the spectrogram is edited. Once the tiles a viewport
+// touches are built, drawing it costs the same for any file length. Not thread-safe.
+#define TILE_SIZE 128
+
+typedef struct Tile {
+    // TILE_SIZE rows of TILE_SIZE cells, row y holding bin (ty * TILE_SIZE + y) at this level.
+    float* cells;
+    bool stale;
+
+    int lt, lf;
+    size_t tx, ty;
+
+    // Least recently used first.
+    struct Tile* prev;
+    struct Tile* next;
+} Tile;
+
+struct TilePyramid {
+    const Spectrodata* sd;
+    size_t spec_size;
+    enum TilePooling pooling;
+
+    int time_levels;
+    int freq_levels;
+
+    // slots[lt * freq_levels + lf] has tiles_x(lt) * tiles_y(lf) entries, NULL until built.
+    Tile*** slots;
+
+    size_t tile_count;
+    size_t max_tiles;
+    Tile* lru_head;
+    Tile* lru_tail;
+};
+
+static size_t pyramid_cells(size_t n, int level) {
+    return (n + ((size_t)1 << level) - 1) >> level;
+}
+
+static size_t pyramid_tiles(size_t n, int level) {
+    return (pyramid_cells(n, level) + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+TilePyramid* tilepyramid_create(const FFTKernel* fk, const Spectrodata* sd, enum TilePooling pooling, size_t max_tiles) {
+    TilePyramid* tp = calloc(1, sizeof(TilePyramid));
+    assert(tp);
+    tp->sd = sd;
+    tp->spec_size = fk->window_size / 2 + 1;
+    tp->pooling = pooling;
+    // Building a tile holds its two children at most, so don't go below that.
+    tp->max_tiles = max_tiles ? (max_tiles < 3 ? 3 : max_tiles) : SIZE_MAX;
+
+    tp->time_levels = 1;
+    while (pyramid_tiles(sd->window_count, tp->time_levels - 1) > 1)
+        tp->time_levels++;
+    tp->freq_levels = 1;
+    while (pyramid_tiles(tp->spec_size, tp->freq_levels - 1) > 1)
+        tp->freq_levels++;
+
+    tp->slots = calloc((size_t)tp->time_levels * tp->freq_levels, sizeof(Tile**));
+    assert(tp->slots);
+    for (int lt = 0; lt < tp->time_levels; lt++) {
+        for (int lf = 0; lf < tp->freq_levels; lf++) {
+            size_t count = pyramid_tiles(sd->window_count, lt) * pyramid_tiles(tp->spec_size, lf);
+            tp->slots[lt * tp->freq_levels + lf] = calloc(count ? count : 1, sizeof(Tile*));
+            assert(tp->slots[lt * tp->freq_levels + lf]);
+        }
+    }
+    return tp;
+}
+
+static Tile** tilepyramid_slot(const TilePyramid* tp, int lt, int lf, size_t tx, size_t ty) {
+    return &tp->slots[lt * tp->freq_levels + lf][ty * pyramid_tiles(tp->sd->window_count, lt) + tx];
+}
+
+static void tile_unlink(TilePyramid* tp, Tile* t) {
+    if (t->prev) t->prev->next = t->next; else tp->lru_head = t->next;
+    if (t->next) t->next->prev = t->prev; else tp->lru_tail = t->prev;
+    t->prev = t->next = NULL;
+}
+
+static void tile_push_back(TilePyramid* tp, Tile* t) {
+    t->prev = tp->lru_tail;
+    t->next = NULL;
+    if (tp->lru_tail) tp->lru_tail->next = t; else tp->lru_head = t;
+    tp->lru_tail = t;
+}
+
+static void tile_evict(TilePyramid* tp, Tile* t) {
+    tile_unlink(tp, t);
+    *tilepyramid_slot(tp, t->lt, t->lf, t->tx, t->ty) = NULL;
+    FFTW(free)(t->cells);
+    free(t);
+    tp->tile_count--;
+}
+
+static void tile_fill_base(const TilePyramid* tp, Tile* t) {
+    const Spectrodata* sd = tp->sd;
+    const size_t x0 = t->tx * TILE_SIZE, y0 = t->ty * TILE_SIZE;
+    const size_t w = x0 < sd->window_count ? MIN(TILE_SIZE, sd->window_count - x0) : 0;
+    const size_t h = y0 < tp->spec_size ? MIN(TILE_SIZE, tp->spec_size - y0) : 0;
+
+    memset(t->cells, 0, TILE_SIZE * TILE_SIZE * sizeof(float));
+    for (size_t x = 0; x < w; x++) {
+        const size_t offset = (x0 + x) * tp->spec_size + y0;
+        for (size_t y = 0; y < h; y++) {
+            const float re = sd->layout == SPECTRO_SPLIT ? sd->re[offset + y] : sd->data[offset + y][0];
+            const float im = sd->layout == SPECTRO_SPLIT ? sd->im[offset + y] : sd->data[offset + y][1];
+            t->cells[y * TILE_SIZE + x] = sqrtf(re * re + im * im);
+        }
+    }
+}
+
+static inline float tile_pool(enum TilePooling pooling, float a, float b, bool b_valid) {
+    if (!b_valid)
+        return a;
+    if (pooling == TILE_POOL_MAX)
+        return a > b ? a : b;
+    return (a + b) * 0.5f;
+}
+
+static const float* tilepyramid_get(TilePyramid* tp, int lt, int lf, size_t tx, size_t ty);
+
+// Pools pairs of cells from the level below: along time if lt > 0, otherwise along frequency.
+static void tile_fill_pooled(TilePyramid* tp, Tile* t) {
+    const bool along_time = t->lt > 0;
+    const int clt = along_time ? t->lt - 1 : 0;
+    const int clf = along_time ? t->lf : t->lf - 1;
+    const size_t child_cells = along_time ? pyramid_cells(tp->sd->window_count, clt) : pyramid_cells(tp->spec_size, clf);
+    const size_t child_tiles = along_time ? pyramid_tiles(tp->sd->window_count, clt) : pyramid_tiles(tp->spec_size, clf);
+
+    memset(t->cells, 0, TILE_SIZE * TILE_SIZE * sizeof(float));
+    for (size_t half = 0; half < 2; half++) {
+        const size_t child_index = (along_time ? t->tx : t->ty) * 2 + half;
+        if (child_index >= child_tiles)
+            break;
+
+        // Each child fills half of this tile. The child is only read until the next get, which may evict it.
+        const float* c = along_time ? tilepyramid_get(tp, clt, clf, child_index, t->ty)
+                                    : tilepyramid_get(tp, clt, clf, t->tx, child_index);
+        const size_t first_cell = child_index * TILE_SIZE;
+        for (size_t i = 0; i < TILE_SIZE / 2; i++) {
+            // The second of a pair can be past the end of the data, when there is an odd number of cells.
+            const bool second_valid = first_cell + 2 * i + 1 < child_cells;
+            if (along_time) {
+                for (size_t y = 0; y < TILE_SIZE; y++) {
+                    const float* row = c + y * TILE_SIZE;
+                    t->cells[y * TILE_SIZE + half * TILE_SIZE / 2 + i] = tile_pool(tp->pooling, row[2 * i], row[2 * i + 1], second_valid);
+                }
+            } else {
+                float* dst = t->cells + (half * TILE_SIZE / 2 + i) * TILE_SIZE;
+                for (size_t x = 0; x < TILE_SIZE; x++)
+                    dst[x] = tile_pool(tp->pooling, c[2 * i * TILE_SIZE + x], c[(2 * i + 1) * TILE_SIZE + x], second_valid);
+            }
+        }
+    }
+}
+
+// The cells of a tile, building it if needed. Valid until the next call that can build tiles.
+static const float* tilepyramid_get(TilePyramid* tp, int lt, int lf, size_t tx, size_t ty) {
+    Tile** slot = tilepyramid_slot(tp, lt, lf, tx, ty);
+    Tile* t = *slot;
+
+    if (t && !t->stale) {
+        tile_unlink(tp, t);
+        tile_push_back(tp, t);
+        return t->cells;
+    }
+
+    if (!t) {
+        t = calloc(1, sizeof(Tile));
+        assert(t);
+        t->cells = FFTW(malloc)(TILE_SIZE * TILE_SIZE * sizeof(float));
+        assert(t->cells);
+        t->lt = lt;
+        t->lf = lf;
+        t->tx = tx;
+        t->ty = ty;
+        *slot = t;
+        tp->tile_count++;
+    } else {
+        // Keep it out of the way of evictions while the children are fetched.
+        tile_unlink(tp, t);
+    }
+
+    if (lt == 0 && lf == 0)
+        tile_fill_base(tp, t);
+    else
+        tile_fill_pooled(tp, t);
+    t->stale = false;
+    tile_push_back(tp, t);
+
+    while (tp->tile_count > tp->max_tiles && tp->lru_head != t)
+        tile_evict(tp, tp->lru_head);
+    return t->cells;
+}
+
+void tilepyramid_invalidate(TilePyramid* tp, size_t first_window, size_t last_window, size_t first_bin, size_t last_bin) {
+    if (first_window >= last_window || first_bin >= last_bin)
+        return;
+
+    for (int lt = 0; lt < tp->time_levels; lt++) {
+        const size_t tx0 = (first_window >> lt) / TILE_SIZE;
+        const size_t tx1 = MIN(((last_window - 1) >> lt) / TILE_SIZE, pyramid_tiles(tp->sd->window_count, lt) - 1);
+        for (int lf = 0; lf < tp->freq_levels; lf++) {
+            const size_t ty0 = (first_bin >> lf) / TILE_SIZE;
+            const size_t ty1 = MIN(((last_bin - 1) >> lf) / TILE_SIZE, pyramid_tiles(tp->spec_size, lf) - 1);
+            for (size_t ty = ty0; ty <= ty1; ty++) {
+                for (size_t tx = tx0; tx <= tx1; tx++) {
+                    Tile* t = *tilepyramid_slot(tp, lt, lf, tx, ty);
+                    if (t)
+                        t->stale = true;
+                }
+            }
+        }
+    }
+}
+
+void tilepyramid_destroy(TilePyramid* tp) {
+    while (tp->lru_head)
+        tile_evict(tp, tp->lru_head);
+    for (int i = 0; i < tp->time_levels * tp->freq_levels; i++)
+        free(tp->slots[i]);
+    free(tp->slots);
+    free(tp);
+}
+
+void tilepyramid_render(TilePyramid* tp, size_t first_window, size_t windows, size_t first_bin, size_t bins,
+                        Imagedata* out, const RenderOptions* opt) {
+    TRACE_SCOPE("render_tiles");
+    render_setup();
+
+    if (!opt)
+        opt = &render_defaults;
+    const Colormap* cm = opt->colormap ? opt->colormap : default_colormap;
+    const LevelMapping m = level_mapping(opt, cm->size);
+    imagedata_resize(out, out->width, out->height, cm->channels);
+    if (out->width <= 0 || out->height <= 0)
+        return;
+
+    int lt = 0, lf = 0;
+    while (lt + 1 < tp->time_levels && ((size_t)out->width << (lt + 1)) <= windows)
+        lt++;
+    while (lf + 1 < tp->freq_levels && ((size_t)out->height << (lf + 1)) <= bins)
+        lf++;
+
+    // Which cell each column shows, or SIZE_MAX past the end of the file.
+    const size_t width = out->width;
+    size_t* columns = malloc(width * sizeof(size_t));
+    uint16_t* levels = malloc(width * sizeof(uint16_t));
+    // The level kernel wants complex bins, so magnitudes go in as the real part with a zero imaginary part.
+    sample* mags = malloc(width * sizeof(sample));
+    sample* zeros = calloc(width, sizeof(sample));
+    assert(columns && levels && mags && zeros);
+    for (size_t px = 0; px < width; px++) {
+        const size_t window = first_window + px * windows / width;
+        columns[px] = window < tp->sd->window_count ? window >> lt : SIZE_MAX;
+    }
+
+    for (int py = 0; py < out->height; py++) {
+        const size_t bin = first_bin + (size_t)(out->height - 1 - py) * bins / out->height;
+        const size_t cy = bin >> lf;
+
+        const float* cells = NULL;
+        size_t cells_tx = SIZE_MAX;
+        for (size_t px = 0; px < width; px++) {
+            const size_t cx = columns[px];
+            if (cx == SIZE_MAX || bin >= tp->spec_size) {
+                mags[px] = 0.0f;
+                continue;
+            }
+            if (cx / TILE_SIZE != cells_tx) {
+                cells_tx = cx / TILE_SIZE;
+                cells = tilepyramid_get(tp, lt, lf, cells_tx, cy / TILE_SIZE) + (cy % TILE_SIZE) * TILE_SIZE;
+            }
+            mags[px] = cells[cx % TILE_SIZE];
+        }
+        level_kernel(levels, NULL, mags, zeros, width, m);
+        colormap_fill_row(out->data + (size_t)py * width * cm->channels, cm, levels, 1, width);
+    }
+
+    free(zeros);
+    free(mags);
+    free(levels);
+    free(columns);
+}
@@ -0,0 +1,29 @@
+#ifndef FOURIEDIT_PYRAMID_H
+#define FOURIEDIT_PYRAMID_H
+
+#include <stddef.h>
+#include "fft.h"
+#include "render.h"
+
+// Tile pyramid.
+
+enum TilePooling {TILE_POOL_MAX, TILE_POOL_MEAN};
+
+typedef struct TilePyramid TilePyramid;
+
+// Keeps at most `max_tiles` tiles around, or any number if it is 0. `sd` must outlive the pyramid.
+TilePyramid* tilepyramid_create(const FFTKernel* fk, const Spectrodata* sd, enum TilePooling pooling, size_t max_tiles);
+
+// Marks every tile covering windows [first_window, last_window) and bins [first_bin, last_bin) as needing a
+// rebuild. Their memory is kept for when they are rebuilt.
+void tilepyramid_invalidate(TilePyramid* tp, size_t first_window, size_t last_window, size_t first_bin, size_t last_bin);
+void tilepyramid_destroy(TilePyramid* tp);
+
+// Draws windows [first_window, first_window + windows) and bins [first_bin, first_bin + bins) into `out`,
+// which must already have its size set, using the coarsest level that still has a cell for every pixel. Anything
+// past the end of the spectrogram is drawn as the lowest level.
+// `opt` may be NULL for the defaults, as with spectro_render_magnitude.
+void tilepyramid_render(TilePyramid* tp, size_t first_window, size_t windows, size_t first_bin, size_t bins,
+                        Imagedata* out, const RenderOptions* opt);
+
+#endif
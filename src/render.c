@@ -0,0 +1,523 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <pthread.h>
+#include "render.h"
+#include "pool.h"
+#include "trace.h"
+#include "simd.h"
+
+// Rendering.
+// Spectrograms are drawn with time running left to right, one column per window, and frequency running
+// bottom to top, one row per bin. Images are modified in place, so their buffers are reused between renders.
+void imagedata_resize(Imagedata* img, int width, int height, int channels) {
+    pool_reserve((void**)&img->data, (size_t)width * height * channels);
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+}
+
+void imagedata_clear(Imagedata* img) {
+    pool_free(img->data);
+    *img = (Imagedata){ 0 };
+}
+
+bool imagedata_write_file(const char* fname, const Imagedata* img) {
+    TRACE_SCOPE("write_image");
+    static const char* const tuple_types[] = { NULL, "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA" };
+    assert(img->channels >= 1 && img->channels <= 4);
+
+    FILE* f = fopen(fname, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to open image file for writing '%s'.\n", fname);
+        return false;
+    }
+
+    fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            img->width, img->height, img->channels, tuple_types[img->channels]);
+    const size_t size = (size_t)img->width * img->height * img->channels;
+    bool ok = fwrite(img->data, 1, size, f) == size;
+    if (fclose(f) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Couldn't write all of image file '%s'.\n", fname);
+    return ok;
+}
+
+static Colormap* colormap_alloc(size_t size, int channels) {
+    Colormap* cm = calloc(1, sizeof(Colormap));
+    assert(cm);
+    cm->size = size;
+    cm->channels = channels;
+    cm->entries = calloc(size, channels);
+    assert(cm->entries);
+    return cm;
+}
+
+Colormap* colormap_create_gray(size_t size) {
+    Colormap* cm = colormap_alloc(size, 2);
+    for (size_t i = 0; i < size; i++) {
+        cm->entries[i * 2] = (uint8_t)(i * 255 / (size - 1));
+        cm->entries[i * 2 + 1] = 0xFF;
+    }
+    return cm;
+}
+
+Colormap* colormap_create_heat(size_t size) {
+    static const uint8_t stops[][3] = {
+        { 0, 0, 0 }, { 80, 18, 123 }, { 182, 54, 121 }, { 251, 136, 97 }, { 252, 253, 191 }, { 255, 255, 255 },
+    };
+    const size_t last = sizeof(stops) / sizeof(stops[0]) - 1;
+
+    Colormap* cm = colormap_alloc(size, 4);
+    for (size_t i = 0; i < size; i++) {
+        const double pos = (double)i / (size - 1) * last;
+        const size_t s = MIN((size_t)pos, last - 1);
+        const double frac = pos - s;
+        for (int c = 0; c < 3; c++)
+            cm->entries[i * 4 + c] = (uint8_t)(stops[s][c] + (stops[s + 1][c] - stops[s][c]) * frac + 0.5);
+        cm->entries[i * 4 + 3] = 0xFF;
+    }
+    return cm;
+}
+
+void colormap_destroy(Colormap* cm) {
+    free(cm->entries);
+    free(cm);
+}
+
+const RenderOptions render_defaults = {
+    .colormap = NULL, .db_floor = -100.0f, .db_ceiling = 0.0f, .phase_accuracy = PHASE_FAST,
+};
+
+LevelMapping level_mapping(const RenderOptions* opt, size_t levels) {
+    // 10 * log10(p) = 10 * log10(2) * log2(p)
+    const float per_db = (levels - 1) / (opt->db_ceiling - opt->db_floor);
+    return (LevelMapping){
+        .scale = 3.01029996f * per_db,
+        .offset = -opt->db_floor * per_db,
+        .max_level = (float)(levels - 1),
+    };
+}
+
+// log2 to within 2e-4 (under 0.001 dB), from the exponent bits and a quartic on the mantissa.
+// Zero comes out as -127, which is far below any floor, rather than -inf.
+#define LOG2_C1 1.43854679f
+#define LOG2_C2 -0.678081486f
+#define LOG2_C3 0.323630368f
+#define LOG2_C4 -0.0842850926f
+
+static inline float fast_log2(float x) {
+    union { float f; uint32_t u; } v = { x };
+    const float e = (float)((int)(v.u >> 23) - 127);
+    v.u = (v.u & 0x007FFFFF) | 0x3F800000;
+    const float t = v.f - 1.0f;
+    return e + t * (LOG2_C1 + t * (LOG2_C2 + t * (LOG2_C3 + t * LOG2_C4)));
+}
+
+static inline uint16_t power_to_level(float power, LevelMapping m) {
+    float f = fast_log2(power) * m.scale + m.offset;
+    // Compared this way round so a NaN never reaches the cast.
+    if (!(f > 0.0f))
+        f = 0.0f;
+    if (f > m.max_level)
+        f = m.max_level;
+    return (uint16_t)f;
+}
+
+// The level kernels; see LevelKernel.
+static void level_kernel_scalar(uint16_t* levels, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, LevelMapping m) {
+    if (bins) {
+        for (size_t i = 0; i < n; i++)
+            levels[i] = power_to_level(bins[i][0] * bins[i][0] + bins[i][1] * bins[i][1], m);
+    } else {
+        for (size_t i = 0; i < n; i++)
+            levels[i] = power_to_level(re[i] * re[i] + im[i] * im[i], m);
+    }
+}
+
+#ifdef HAVE_X86_DISPATCH
+// Same arithmetic as the scalar path, in the same order and without FMA, so the levels match it exactly.
+__attribute__((target("avx2")))
+static inline __m256 fast_log2_avx2(__m256 x) {
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    const __m256 mant = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                                                            _mm256_set1_epi32(0x3F800000)));
+    const __m256 t = _mm256_sub_ps(mant, _mm256_set1_ps(1.0f));
+
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(LOG2_C3), _mm256_mul_ps(t, _mm256_set1_ps(LOG2_C4)));
+    p = _mm256_add_ps(_mm256_set1_ps(LOG2_C2), _mm256_mul_ps(t, p));
+    p = _mm256_add_ps(_mm256_set1_ps(LOG2_C1), _mm256_mul_ps(t, p));
+    return _mm256_add_ps(e, _mm256_mul_ps(t, p));
+}
+
+__attribute__((target("avx2")))
+static inline void store_levels_avx2(uint16_t* levels, __m256 power, LevelMapping m) {
+    __m256 f = _mm256_add_ps(_mm256_mul_ps(fast_log2_avx2(power), _mm256_set1_ps(m.scale)), _mm256_set1_ps(m.offset));
+    // max returns its second operand for NaN, same as the scalar clamp.
+    f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(m.max_level));
+
+    // packus works per 128-bit lane, so gather the two useful quarters back together afterwards.
+    const __m256i i32 = _mm256_cvttps_epi32(f);
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(i32, i32), 0x08);
+    _mm_storeu_si128((__m128i*)levels, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2")))
+static void level_kernel_avx2(uint16_t* levels, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, LevelMapping m) {
+    size_t i = 0;
+    if (bins) {
+        for (; i + 8 <= n; i += 8) {
+            const __m256 a = _mm256_loadu_ps(bins[i]);
+            const __m256 b = _mm256_loadu_ps(bins[i + 4]);
+            // hadd gives p0 p1 p4 p5 | p2 p3 p6 p7.
+            const __m256 h = _mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+            const __m256 power = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+            store_levels_avx2(levels + i, power, m);
+        }
+        level_kernel_scalar(levels + i, bins + i, NULL, NULL, n - i, m);
+    } else {
+        for (; i + 8 <= n; i += 8) {
+            const __m256 r = _mm256_loadu_ps(re + i);
+            const __m256 q = _mm256_loadu_ps(im + i);
+            store_levels_avx2(levels + i, _mm256_add_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(q, q)), m);
+        }
+        level_kernel_scalar(levels + i, NULL, re + i, im + i, n - i, m);
+    }
+}
+#endif
+
+static LevelKernel level_kernel_select(void) {
+    if (getenv("FOURIEDIT_NO_SIMD"))
+        return level_kernel_scalar;
+
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return level_kernel_avx2;
+#endif
+    return level_kernel_scalar;
+}
+
+// Phase.
+// atan2 is reduced to atan on [0, 1] and then unfolded by octant, all in turns rather than radians so the
+// result indexes a hue table directly. The polynomials are odd in x, so they are stored as P(x^2).
+typedef struct {
+    int terms;
+    float coeffs[5];
+
+    // A power of two.
+    size_t hues;
+} PhaseMapping;
+
+static const PhaseMapping phase_mappings[] = {
+    // 0.005 rad.
+    [PHASE_FAST] = {
+        .terms = 2,
+        .coeffs = { 0.97239411f / (2 * M_PI), -0.19194795f / (2 * M_PI) },
+        .hues = 256,
+    },
+    // 1.2e-5 rad. Abramowitz and Stegun 4.4.49.
+    [PHASE_ACCURATE] = {
+        .terms = 5,
+        .coeffs = { 0.9998660f / (2 * M_PI), -0.3302995f / (2 * M_PI), 0.1801410f / (2 * M_PI),
+                    -0.0851330f / (2 * M_PI), 0.0208351f / (2 * M_PI) },
+        .hues = 4096,
+    },
+};
+
+static inline uint16_t bin_to_hue(float re, float im, const PhaseMapping* pm) {
+    const float ax = fabsf(re), ay = fabsf(im);
+    const float mn = ax < ay ? ax : ay;
+    const float mx = ax > ay ? ax : ay;
+    const float a = mn / (mx > FLT_MIN ? mx : FLT_MIN);
+    const float s = a * a;
+
+    float p = pm->coeffs[pm->terms - 1];
+    for (int i = pm->terms - 2; i >= 0; i--)
+        p = p * s + pm->coeffs[i];
+    float t = a * p;
+
+    if (ay > ax)
+        t = 0.25f - t;
+    if (re < 0)
+        t = 0.5f - t;
+    t = copysignf(t, im);
+
+    // t is in [-0.5, 0.5]; shift it positive and let the mask wrap it.
+    float f = t * pm->hues + (pm->hues + 0.5f);
+    if (!(f > 0.0f))
+        f = 0.0f;
+    return (uint16_t)((uint32_t)f & (pm->hues - 1));
+}
+
+typedef void (*PhaseKernel)(uint16_t* hues, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, const PhaseMapping* pm);
+
+static void phase_kernel_scalar(uint16_t* hues, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, const PhaseMapping* pm) {
+    if (bins) {
+        for (size_t i = 0; i < n; i++)
+            hues[i] = bin_to_hue(bins[i][0], bins[i][1], pm);
+    } else {
+        for (size_t i = 0; i < n; i++)
+            hues[i] = bin_to_hue(re[i], im[i], pm);
+    }
+}
+
+#ifdef HAVE_X86_DISPATCH
+// Step for step the same as bin_to_hue.
+__attribute__((target("avx2")))
+static inline void store_hues_avx2(uint16_t* hues, __m256 re, __m256 im, const PhaseMapping* pm) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 ax = _mm256_andnot_ps(sign, re);
+    const __m256 ay = _mm256_andnot_ps(sign, im);
+    const __m256 mn = _mm256_min_ps(ax, ay);
+    const __m256 mx = _mm256_max_ps(ax, ay);
+    const __m256 a = _mm256_div_ps(mn, _mm256_max_ps(mx, _mm256_set1_ps(FLT_MIN)));
+    const __m256 s = _mm256_mul_ps(a, a);
+
+    __m256 p = _mm256_set1_ps(pm->coeffs[pm->terms - 1]);
+    for (int i = pm->terms - 2; i >= 0; i--)
+        p = _mm256_add_ps(_mm256_mul_ps(p, s), _mm256_set1_ps(pm->coeffs[i]));
+    __m256 t = _mm256_mul_ps(a, p);
+
+    t = _mm256_blendv_ps(t, _mm256_sub_ps(_mm256_set1_ps(0.25f), t), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    t = _mm256_blendv_ps(t, _mm256_sub_ps(_mm256_set1_ps(0.5f), t), _mm256_cmp_ps(re, _mm256_setzero_ps(), _CMP_LT_OQ));
+    t = _mm256_or_ps(_mm256_andnot_ps(sign, t), _mm256_and_ps(sign, im));
+
+    __m256 f = _mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps((float)pm->hues)), _mm256_set1_ps(pm->hues + 0.5f));
+    f = _mm256_max_ps(f, _mm256_setzero_ps());
+    __m256i i32 = _mm256_and_si256(_mm256_cvttps_epi32(f), _mm256_set1_epi32((int)pm->hues - 1));
+
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(i32, i32), 0x08);
+    _mm_storeu_si128((__m128i*)hues, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2")))
+static void phase_kernel_avx2(uint16_t* hues, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, const PhaseMapping* pm) {
+    size_t i = 0;
+    if (bins) {
+        for (; i + 8 <= n; i += 8) {
+            // Deinterleave to r0..r7 and i0..i7; the permute undoes the lane split of the shuffles.
+            const __m256 a = _mm256_loadu_ps(bins[i]);
+            const __m256 b = _mm256_loadu_ps(bins[i + 4]);
+            const __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m256 q = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            store_hues_avx2(hues + i,
+                            _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), 0xD8)),
+                            _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(q), 0xD8)), pm);
+        }
+        phase_kernel_scalar(hues + i, bins + i, NULL, NULL, n - i, pm);
+    } else {
+        for (; i + 8 <= n; i += 8)
+            store_hues_avx2(hues + i, _mm256_loadu_ps(re + i), _mm256_loadu_ps(im + i), pm);
+        phase_kernel_scalar(hues + i, NULL, re + i, im + i, n - i, pm);
+    }
+}
+#endif
+
+static PhaseKernel phase_kernel_select(void) {
+    if (getenv("FOURIEDIT_NO_SIMD"))
+        return phase_kernel_scalar;
+
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return phase_kernel_avx2;
+#endif
+    return phase_kernel_scalar;
+}
+
+// Fully saturated RGBA for each hue, starting from red at phase 0 and going through yellow at 60 degrees.
+static uint8_t* hue_table_create(size_t hues) {
+    uint8_t* table = malloc(hues * 4);
+    assert(table);
+    for (size_t i = 0; i < hues; i++) {
+        const double h = 6.0 * i / hues;
+        const int sector = (int)h;
+        const uint8_t up = (uint8_t)((h - sector) * 255 + 0.5);
+        const uint8_t down = 255 - up;
+        static const int channel_of[6][3] = {
+            // Which of (full, up, down, zero) goes in r, g, b.
+            { 0, 1, 3 }, { 2, 0, 3 }, { 3, 0, 1 }, { 3, 2, 0 }, { 1, 3, 0 }, { 0, 3, 2 },
+        };
+        const uint8_t values[4] = { 255, up, down, 0 };
+        for (int c = 0; c < 3; c++)
+            table[i * 4 + c] = values[channel_of[sector][c]];
+        table[i * 4 + 3] = 0xFF;
+    }
+    return table;
+}
+
+void colormap_fill_row(uint8_t* row, const Colormap* cm, const uint16_t* levels, size_t stride, size_t count) {
+    switch (cm->channels) {
+        case 2:
+            for (size_t x = 0; x < count; x++)
+                memcpy(row + x * 2, cm->entries + levels[x * stride] * 2, 2);
+        break;
+
+        case 4:
+            for (size_t x = 0; x < count; x++)
+                memcpy(row + x * 4, cm->entries + levels[x * stride] * 4, 4);
+        break;
+
+        default:
+            for (size_t x = 0; x < count; x++)
+                memcpy(row + x * cm->channels, cm->entries + levels[x * stride] * cm->channels, cm->channels);
+        break;
+    }
+}
+
+Colormap* default_colormap;
+LevelKernel level_kernel;
+static PhaseKernel phase_kernel;
+static uint8_t* hue_tables[2];
+static pthread_once_t render_once = PTHREAD_ONCE_INIT;
+
+static void render_init(void) {
+    default_colormap = colormap_create_gray(256);
+    level_kernel = level_kernel_select();
+    phase_kernel = phase_kernel_select();
+    for (int i = 0; i < 2; i++)
+        hue_tables[i] = hue_table_create(phase_mappings[i].hues);
+}
+
+void render_setup(void) {
+    pthread_once(&render_once, render_init);
+}
+
+void spectro_render_magnitude(const FFTKernel* fk, const Spectrodata* in, Imagedata* out, const RenderOptions* opt) {
+    TRACE_SCOPE("render_magnitude");
+    render_setup();
+
+    if (!opt)
+        opt = &render_defaults;
+    const Colormap* cm = opt->colormap ? opt->colormap : default_colormap;
+
+    const size_t spec_size = fk->window_size / 2 + 1;
+    const size_t width = in->window_count;
+    imagedata_resize(out, (int)width, (int)spec_size, cm->channels);
+
+    const LevelMapping m = level_mapping(opt, cm->size);
+    uint16_t* levels = malloc(RENDER_TILE * spec_size * sizeof(uint16_t));
+    assert(levels);
+
+    const size_t row_bytes = width * cm->channels;
+    for (size_t x0 = 0; x0 < width; x0 += RENDER_TILE) {
+        const size_t count = MIN(RENDER_TILE, width - x0);
+
+        for (size_t x = 0; x < count; x++) {
+            const size_t offset = (x0 + x) * spec_size;
+            if (in->layout == SPECTRO_SPLIT)
+                level_kernel(levels + x * spec_size, NULL, in->re + offset, in->im + offset, spec_size, m);
+            else
+                level_kernel(levels + x * spec_size, in->data + offset, NULL, NULL, spec_size, m);
+        }
+
+        // The highest bin goes on the top row.
+        for (size_t b = 0; b < spec_size; b++) {
+            uint8_t* row = out->data + (spec_size - 1 - b) * row_bytes + x0 * cm->channels;
+            colormap_fill_row(row, cm, levels + b, spec_size, count);
+        }
+    }
+
+    free(levels);
+}
+
+void spectro_to_image_basic(const FFTKernel* fk, const Spectrodata* in, Imagedata* out) {
+    spectro_render_magnitude(fk, in, out, NULL);
+}
+
+// Domain coloring draws each bin in RGBA with its phase as the hue and its level in decibels as the brightness.
+// The image is cut into bands of rows, which are independent, so they can go to a thread pool.
+typedef struct {
+    const Spectrodata* sd;
+    Imagedata* out;
+    size_t spec_size;
+    LevelMapping levels;
+    const PhaseMapping* phases;
+    const uint8_t* hue_table;
+    size_t task_count;
+} DomainJob;
+
+static void domain_task(void* ctx, size_t task, size_t worker) {
+    TRACE_SCOPE("render_domain_coloring");
+    (void)worker;
+    const DomainJob* job = ctx;
+    const Spectrodata* sd = job->sd;
+    const size_t first = job->spec_size * task / job->task_count;
+    const size_t rows = job->spec_size * (task + 1) / job->task_count - first;
+    const size_t width = sd->window_count;
+    if (rows == 0)
+        return;
+
+    uint16_t* levels = malloc(RENDER_TILE * rows * sizeof(uint16_t) * 2);
+    assert(levels);
+    uint16_t* hues = levels + RENDER_TILE * rows;
+
+    for (size_t x0 = 0; x0 < width; x0 += RENDER_TILE) {
+        const size_t count = MIN(RENDER_TILE, width - x0);
+
+        for (size_t x = 0; x < count; x++) {
+            const size_t offset = (x0 + x) * job->spec_size + first;
+            if (sd->layout == SPECTRO_SPLIT) {
+                level_kernel(levels + x * rows, NULL, sd->re + offset, sd->im + offset, rows, job->levels);
+                phase_kernel(hues + x * rows, NULL, sd->re + offset, sd->im + offset, rows, job->phases);
+            } else {
+                level_kernel(levels + x * rows, sd->data + offset, NULL, NULL, rows, job->levels);
+                phase_kernel(hues + x * rows, sd->data + offset, NULL, NULL, rows, job->phases);
+            }
+        }
+
+        for (size_t b = 0; b < rows; b++) {
+            uint8_t* row = job->out->data + ((job->spec_size - 1 - first - b) * width + x0) * 4;
+            for (size_t x = 0; x < count; x++) {
+                const uint8_t* hue = job->hue_table + hues[x * rows + b] * 4;
+                const unsigned level = levels[x * rows + b];
+                row[x * 4 + 0] = (uint8_t)((hue[0] * level + 127) / 255);
+                row[x * 4 + 1] = (uint8_t)((hue[1] * level + 127) / 255);
+                row[x * 4 + 2] = (uint8_t)((hue[2] * level + 127) / 255);
+                row[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    free(levels);
+}
+
+void spectro_render_domain_coloring(const FFTKernel* fk, ThreadPool* pool, const Spectrodata* in, Imagedata* out, const RenderOptions* opt) {
+    render_setup();
+
+    if (!opt)
+        opt = &render_defaults;
+
+    const size_t spec_size = fk->window_size / 2 + 1;
+    imagedata_resize(out, (int)in->window_count, (int)spec_size, 4);
+
+    DomainJob job = {
+        .sd = in,
+        .out = out,
+        .spec_size = spec_size,
+        .levels = level_mapping(opt, 256),
+        .phases = &phase_mappings[opt->phase_accuracy],
+        .hue_table = hue_tables[opt->phase_accuracy],
+        // Bands of at least 64 rows, a few per worker.
+        .task_count = MIN(pool ? pool->thread_count * 4 : 1, (spec_size + 63) / 64),
+    };
+
+    if (pool) {
+        threadpool_run(pool, domain_task, &job, job.task_count);
+    } else {
+        for (size_t task = 0; task < job.task_count; task++)
+            domain_task(&job, task, 0);
+    }
+}
+
+void spectro_to_image_domain_coloring(const FFTKernel* fk, const Spectrodata* in, Imagedata* out) {
+    spectro_render_domain_coloring(fk, NULL, in, out, NULL);
+}
@@ -0,0 +1,99 @@
+#ifndef FOURIEDIT_RENDER_H
+#define FOURIEDIT_RENDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fft.h"
+
+// Drawing spectrograms as images.
+
+typedef struct {
+    uint8_t* data;
+    int width;
+    int height;
+    int channels;
+} Imagedata;
+
+void imagedata_clear(Imagedata* img);
+
+// Writes a PAM (netpbm P7) file, which can hold any of the channel counts we make.
+bool imagedata_write_file(const char* fname, const Imagedata* img);
+
+// A lookup table from a level in [0, size) to a pixel of `channels` bytes.
+typedef struct {
+    size_t size;
+    int channels;
+    uint8_t* entries;
+} Colormap;
+
+// Black to white, with an opaque alpha channel (2ch).
+Colormap* colormap_create_gray(size_t size);
+
+// Black through purple, red and yellow to white, RGBA (4ch).
+Colormap* colormap_create_heat(size_t size);
+void colormap_destroy(Colormap* cm);
+
+// How closely domain coloring follows the phase. Fast is good to 0.3 degrees over 256 hues; accurate to
+// 0.001 degrees over 4096 hues, for a little more time and a bigger table.
+enum PhaseAccuracy {PHASE_FAST, PHASE_ACCURATE};
+
+typedef struct {
+    // NULL means a 256-level gray map. Domain coloring doesn't use it.
+    const Colormap* colormap;
+
+    // The decibel range spread over the colormap; everything outside it is clamped. 0 dB is a bin of magnitude 1.
+    float db_floor;
+    float db_ceiling;
+
+    // Domain coloring only.
+    enum PhaseAccuracy phase_accuracy;
+} RenderOptions;
+
+extern const RenderOptions render_defaults;
+
+// Draws |X| in decibels through a colormap. `opt` may be NULL for the defaults.
+void spectro_render_magnitude(const FFTKernel* fk, const Spectrodata* in, Imagedata* out, const RenderOptions* opt);
+
+// Generates a black-and-white (2ch) image with only the magnitude information displayed.
+void spectro_to_image_basic(const FFTKernel* fk, const Spectrodata* in, Imagedata* out);
+
+// Draws phase as hue and |X| in decibels as brightness, into a colored (4ch) image. `pool` may be NULL to
+// draw on the calling thread, and `opt` may be NULL for the defaults.
+void spectro_render_domain_coloring(const FFTKernel* fk, ThreadPool* pool, const Spectrodata* in, Imagedata* out, const RenderOptions* opt);
+
+// This one is similar to `basic`, but the hue of the color is based on the phase.
+void spectro_to_image_domain_coloring(const FFTKernel* fk, const Spectrodata* in, Imagedata* out);
+
+// For the other renderers, which turn their own magnitudes into pixels the same way.
+
+// Selects the kernels and builds the tables the first time it is called. Every renderer calls it first.
+void render_setup(void);
+
+// Makes `img` the given shape, keeping its buffer if it is big enough. The pixels are left undefined.
+void imagedata_resize(Imagedata* img, int width, int height, int channels);
+
+// Turns power into a colormap level: clamp(log2(power) * scale + offset, 0, max_level), truncated.
+typedef struct {
+    float scale;
+    float offset;
+    float max_level;
+} LevelMapping;
+
+LevelMapping level_mapping(const RenderOptions* opt, size_t levels);
+
+// Level kernels: levels[i] for the n bins starting at `bins`, or at re/im for split spectra.
+typedef void (*LevelKernel)(uint16_t* levels, const FFTW(complex)* bins, const sample* re, const sample* im, size_t n, LevelMapping m);
+
+// The best level kernel for this CPU, and the map used when RenderOptions has none. Set by render_setup.
+extern LevelKernel level_kernel;
+extern Colormap* default_colormap;
+
+// How many windows are turned into levels before they are written out as columns. The levels for a tile
+// stay in cache while the rows are filled in.
+#define RENDER_TILE 32
+
+// Copies `count` colormap entries into a row of pixels, taking every `stride`th level.
+void colormap_fill_row(uint8_t* row, const Colormap* cm, const uint16_t* levels, size_t stride, size_t count);
+
+#endif
@@ -0,0 +1,50 @@
+#include "sample_io.h"
+
+// libsndfile reads and writes float and double; long double goes through a double block.
+sf_count_t sf_readf_sample(SNDFILE* sndfile, sample* ptr, sf_count_t frames, int channels) {
+#if defined(FOURIEDIT_LONG_DOUBLE)
+    double block[4096];
+    const sf_count_t block_frames = channels < 4096 ? 4096 / channels : 1;
+    sf_count_t done = 0;
+    while (done < frames) {
+        const sf_count_t want = frames - done < block_frames ? frames - done : block_frames;
+        const sf_count_t got = sf_readf_double(sndfile, block, want);
+        if (got <= 0)
+            break;
+        for (sf_count_t i = 0; i < got * channels; i++)
+            ptr[done * channels + i] = block[i];
+        done += got;
+    }
+    return done;
+#elif defined(FOURIEDIT_DOUBLE)
+    (void) channels;
+    return sf_readf_double(sndfile, ptr, frames);
+#else
+    (void) channels;
+    return sf_readf_float(sndfile, ptr, frames);
+#endif
+}
+
+sf_count_t sf_writef_sample(SNDFILE* sndfile, const sample* ptr, sf_count_t frames, int channels) {
+#if defined(FOURIEDIT_LONG_DOUBLE)
+    double block[4096];
+    const sf_count_t block_frames = channels < 4096 ? 4096 / channels : 1;
+    sf_count_t done = 0;
+    while (done < frames) {
+        const sf_count_t want = frames - done < block_frames ? frames - done : block_frames;
+        for (sf_count_t i = 0; i < want * channels; i++)
+            block[i] = ptr[done * channels + i];
+        const sf_count_t put = sf_writef_double(sndfile, block, want);
+        if (put <= 0)
+            break;
+        done += put;
+    }
+    return done;
+#elif defined(FOURIEDIT_DOUBLE)
+    (void) channels;
+    return sf_writef_double(sndfile, ptr, frames);
+#else
+    (void) channels;
+    return sf_writef_float(sndfile, ptr, frames);
+#endif
+}
@@ -0,0 +1,12 @@
+#ifndef FOURIEDIT_SAMPLE_IO_H
+#define FOURIEDIT_SAMPLE_IO_H
+
+#include <sndfile.h>
+#include "typename.h"
+
+// sf_readf_float and sf_writef_float, or their double versions, for whatever `sample` is in this build.
+// `channels` is the file's channel count, which the long double build needs to convert in blocks.
+sf_count_t sf_readf_sample(SNDFILE* sndfile, sample* ptr, sf_count_t frames, int channels);
+sf_count_t sf_writef_sample(SNDFILE* sndfile, const sample* ptr, sf_count_t frames, int channels);
+
+#endif
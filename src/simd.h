@@ -0,0 +1,21 @@
+#ifndef FOURIEDIT_SIMD_H
+#define FOURIEDIT_SIMD_H
+
+#include "typename.h"
+
+// Which SIMD kernels this build has. The x86 ones are picked at run time by what the CPU supports.
+// The SIMD kernels are written for float samples; other precisions use the scalar ones.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#ifdef SAMPLE_IS_FLOAT
+#define HAVE_X86_DISPATCH
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#ifdef SAMPLE_IS_FLOAT
+#define HAVE_NEON_KERNELS
+#endif
+#endif
+
+#endif
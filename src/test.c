@@ -1,6 +1,36 @@
+#include <stdio.h>
 #include "fft.h"
-#include <stdbool.h>
+#include "render.h"
 
+// Reads test.wav, draws the magnitudes of its first channel to out.pam and resynthesizes it to test_out.wav.
+// Build it with the library sources in place of main.c.
 int main() {
-    _app_config_create("test.wav", "out.png", 4096, 2048, SPEC_MAGNITUDE, true);
-}
\ No newline at end of file
+    Audiodata* ad = audiodata_read_file("test.wav");
+    if (!ad) {
+        return 1;
+    }
+
+    FFTKernel* fk = fftkernel_create(WF_HANN, 4096, 2048);
+    AudiodataMany* am = audiodata_split_channels(ad);
+
+    Spectrodata* sd = fftkernel_execute_forward(fk, &am->data[0]);
+    if (!sd) {
+        fprintf(stderr, "Couldn't transform test.wav\n");
+        return 1;
+    }
+
+    Imagedata img = { 0 };
+    spectro_render_magnitude(fk, sd, &img, NULL);
+    bool ok = imagedata_write_file("out.pam", &img);
+
+    Audiodata* out = fftkernel_execute_reverse(fk, sd);
+    audiodata_write_file("test_out.wav", out);
+
+    audiodata_destroy(out);
+    imagedata_clear(&img);
+    spectrodata_destroy(sd);
+    audiodata_many_destroy(am);
+    audiodata_destroy(ad);
+    fftkernel_destroy(fk);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "trace.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+// The trace buffer and the Chrome trace writer; see trace.h.
+#ifdef FOURIEDIT_TRACE
+#define TRACE_CAPACITY ((size_t)1 << 20)
+
+typedef struct {
+    const char* name;
+    uint32_t tid;
+    double start;
+    double duration;
+} TraceEvent;
+
+static struct {
+    // NULL unless tracing was started.
+    TraceEvent* events;
+    size_t count;
+    uint32_t next_tid;
+    char path[1024];
+} trace;
+
+bool trace_on;
+
+static _Thread_local uint32_t trace_tid;
+
+double trace_now_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1e6 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+#endif
+}
+
+void trace_record(const char* name, double start, double end) {
+    if (!trace_tid)
+        trace_tid = __atomic_add_fetch(&trace.next_tid, 1, __ATOMIC_RELAXED);
+
+    // Events past the capacity are dropped.
+    const size_t index = __atomic_fetch_add(&trace.count, 1, __ATOMIC_RELAXED);
+    if (index < TRACE_CAPACITY)
+        trace.events[index] = (TraceEvent){ name, trace_tid, start, end - start };
+}
+
+static void trace_save(void) {
+    FILE* f = fopen(trace.path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open trace file for writing '%s'.\n", trace.path);
+        return;
+    }
+
+    const size_t count = trace.count < TRACE_CAPACITY ? trace.count : TRACE_CAPACITY;
+    if (trace.count > TRACE_CAPACITY)
+        fprintf(stderr, "Trace buffer full; dropped %zu events.\n", trace.count - TRACE_CAPACITY);
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (size_t i = 0; i < count; i++) {
+        const TraceEvent* e = &trace.events[i];
+        fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                i ? "," : "", e->name, e->tid, e->start, e->duration);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+
+void trace_start(const char* path) {
+    if (trace.events)
+        return;
+    snprintf(trace.path, sizeof(trace.path), "%s", path);
+    trace.events = malloc(TRACE_CAPACITY * sizeof(TraceEvent));
+    assert(trace.events);
+    trace_on = true;
+    atexit(trace_save);
+}
+#endif
@@ -0,0 +1,48 @@
+#ifndef FOURIEDIT_TRACE_H
+#define FOURIEDIT_TRACE_H
+
+// Tracing.
+// Build with -DFOURIEDIT_TRACE and pass --trace FILE to record how long each stage takes, as Chrome trace events
+// that chrome://tracing and ui.perfetto.dev can open. Without the define, TRACE_SCOPE compiles to nothing; with it
+// but without --trace, a scope costs a couple of flag checks. A scope lasts until the end of its block.
+#ifdef FOURIEDIT_TRACE
+#include <stdbool.h>
+
+typedef struct {
+    // NULL when tracing is off.
+    const char* name;
+    double start;
+} TraceScope;
+
+// Set once trace_start has been called.
+extern bool trace_on;
+
+double trace_now_us(void);
+
+// Adds a finished scope to the trace. `start` and `end` come from trace_now_us.
+void trace_record(const char* name, double start, double end);
+
+static inline TraceScope trace_scope_begin(const char* name) {
+    if (!trace_on)
+        return (TraceScope){ NULL, 0 };
+    return (TraceScope){ name, trace_now_us() };
+}
+
+static inline void trace_scope_end(const TraceScope* scope) {
+    if (scope->name)
+        trace_record(scope->name, scope->start, trace_now_us());
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+// `name` must outlive the program, like a string literal.
+#define TRACE_SCOPE(name) \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name)
+
+// Starts recording; the events are written to `path` on exit.
+void trace_start(const char* path);
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif
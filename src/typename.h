@@ -2,7 +2,26 @@
 #include <stdint.h>
 #include <fftw3.h>
 
-typedef uint8_t byte;
+// The sample precision is picked at compile time: -DFOURIEDIT_DOUBLE or -DFOURIEDIT_LONG_DOUBLE, and float
+// otherwise. FFTW(name) is the FFTW function or type of the same precision, e.g. FFTW(plan), FFTW(complex).
+#if defined(FOURIEDIT_LONG_DOUBLE)
+typedef long double sample;
+#define FFTW(name) fftwl_##name
+#define FFTW_PREFIX "fftwl"
+#define SAMPLE_NAME "long double"
+#elif defined(FOURIEDIT_DOUBLE)
 typedef double sample;
+#define FFTW(name) fftw_##name
+#define FFTW_PREFIX "fftw"
+#define SAMPLE_NAME "double"
+#else
+typedef float sample;
+#define FFTW(name) fftwf_##name
+#define FFTW_PREFIX "fftwf"
+#define SAMPLE_NAME "float"
+#define SAMPLE_IS_FLOAT
+#endif
+
+typedef uint8_t byte;
 typedef size_t sample_count;
-typedef fftw_complex complex;
\ No newline at end of file
+typedef FFTW(complex) complex;